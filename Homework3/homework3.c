@@ -7,8 +7,31 @@
 #include <sys/wait.h>   // For wait
 #include <errno.h>      
 #include <string.h>     // For strerror
+#include <sys/mman.h>   // For mmap (the shared rings)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <time.h>       // For clock_gettime
+#include <stdint.h>
+#include <limits.h>     // For INT_MAX
+#include <signal.h>     // For kill, sigaction
 
 #define FIFO_NAME "/tmp/my_command_fifo"
+#define BUS_NAME "/hm3_bus"     // shm_open name of the pub/sub log
+
+#define MAX_CLASSES 16
+#define DISPATCH_BATCH 256  // Messages per read()/write() in the dispatcher
+#define RING_SLOTS 1024     // Messages per shared ring, a power of two
+#define IO_BATCH 1024       // Bulk mode: messages per write() / ring publish in Process I
+#define LAT_EVERY 64        // Bulk mode: one latency sample per LAT_EVERY messages of a class
+#define LAT_SLOTS 65536     // Send times kept per class (wraps)
+#define LOG_SLOTS 65536     // Messages kept in the pub/sub log, a power of two
+#define MAX_SUBSCRIBERS 64
+
+// How messages travel ("-t")
+#define TRANSPORT_FIFO 0    // I -> FIFO -> Dispatcher -> pipe per consumer
+#define TRANSPORT_SHM  1    // I -> shared-memory ring per consumer
+#define TRANSPORT_BUS  2    // I -> one shared log, subscribers pick their topics
 
 // Define the message structure
 struct message {
@@ -16,24 +39,483 @@ struct message {
     int number;
 };
 
+// Single-producer single-consumer ring in memory shared by Process I
+// and one consumer. Publishing a message is a store to the slot and
+// one to tail, no system call. head and tail sit on their own cache
+// lines, and each side keeps a private copy of the other's index so
+// the shared line is only read when the ring looks full (or empty).
+// A consumer that finds the ring empty sleeps on a futex on tail,
+// after saying so in consumer_idle; Process I only makes the wake-up
+// call when it sees the flag. The same, reversed, when I finds it full.
+struct ring {
+    // Process I's line
+    _Alignas(64) atomic_uint tail;
+    atomic_int producer_waiting;
+    unsigned head_cache;
+    // Consumer's line
+    _Alignas(64) atomic_uint head;
+    atomic_int consumer_idle;
+    unsigned tail_cache;
+    _Alignas(64) struct message slot[RING_SLOTS];
+};
+
+// Publish/subscribe bus: a single log of messages in a named shared
+// memory object, so that any process can attach to it while Process
+// I is publishing ("-s topics"). Each message is written into the log
+// once, whatever the number of subscribers; a subscriber reads the
+// log from its own cursor and skips the topics (commands) it did not
+// ask for. 'q' is for everybody.
+//
+// Joining and leaving take no lock: a subscriber claims a free entry
+// of the table with a compare-and-swap, starts its cursor at the
+// current tail and becomes ACTIVE; leaving is setting it back to
+// FREE. Process I only looks at the table when the log seems full:
+// it may not overwrite what the slowest ACTIVE subscriber has not
+// read (JOINING ones are not waited for, they start at the tail).
+// If that subscriber is gone without leaving, it is evicted.
+#define SUB_FREE    0
+#define SUB_JOINING 1
+#define SUB_ACTIVE  2
+
+struct subscriber {
+    _Alignas(64) atomic_int state;
+    atomic_ullong cursor;           // Next log position to read
+    pid_t pid;
+    unsigned char topics[256];      // topics[c]: wants command c
+};
+
+struct bus {
+    // Process I's line
+    _Alignas(64) atomic_ullong tail;    // Positions published
+    atomic_uint pub_seq;                // Bumped when sleepers must look at tail (futex)
+    atomic_int closed;                  // 'q' published, no more messages
+    uint64_t min_cache;                 // Process I: slowest cursor last time it looked
+    // Subscribers' line
+    _Alignas(64) atomic_int sleepers;   // Subscribers waiting on pub_seq
+    atomic_int publisher_waiting;       // Process I waits for room on read_seq
+    atomic_uint read_seq;
+    struct subscriber sub[MAX_SUBSCRIBERS];
+    _Alignas(64) struct message log[LOG_SLOTS];
+};
+
+static struct bus *bus = NULL;
+
+// One consumer process per command class, fed through its own
+// channel: a pipe from the dispatcher, or a ring from Process I.
+// On the bus: one subscriber per topic list of the command line.
+struct consumer_class {
+    char command;       // The command it handles
+    const char *topics; // Bus: the commands it subscribes to
+    const char *mark;   // Printed in front of its messages
+    int fd[2];          // Channel: dispatcher writes fd[1], consumer reads fd[0]
+    struct ring *ring;  // Channel in shm mode
+    pid_t pid;
+};
+
+static int transport = TRANSPORT_FIFO;
+
+// Bulk mode ("-f file" or "-g count"): Process I streams commands
+// as fast as it can and the consumers stay quiet
+static const char *script = NULL;
+static long gen_count = 0;
+#define BULK (script != NULL || gen_count > 0)
+
+// Bulk mode measurements, shared by every process. Process I notes
+// the send time of every LAT_EVERY-th message of each class; the
+// consumer of that class counts its messages too, so it knows which
+// of them carry a time and takes the difference on arrival.
+struct bulk_stats {
+    uint64_t start_ns;                  // First message sent
+    uint64_t last_ns[MAX_CLASSES];      // Last message delivered, per consumer
+    long delivered[MAX_CLASSES];
+    uint64_t sent_ns[MAX_CLASSES][LAT_SLOTS];
+};
+
+static struct bulk_stats *stats = NULL;
+
+static struct consumer_class classes[MAX_CLASSES];
+static int n_classes = 0;
+
+// Every command somebody handles, for the generator (-g)
+static char topic_list[257];
+static int n_topics = 0;
+
+// Dispatch table: command -> index in classes, -1 = nobody handles it
+static int route[256];
+
+static const char *marks[] = { "---", "+++", "***", "===", "~~~", "###" };
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static long futex(atomic_uint *addr, int op, unsigned val) {
+    // Not FUTEX_PRIVATE_FLAG: the rings are shared between processes
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+static long futex_wait_ms(atomic_uint *addr, unsigned val, int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+// Process I: append one message, waiting while the ring is full
+static void ring_push(struct ring *r, const struct message *msg) {
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    while (tail - r->head_cache == RING_SLOTS) {
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail - r->head_cache < RING_SLOTS) break;
+        atomic_store(&r->producer_waiting, 1);
+        unsigned head = atomic_load(&r->head);
+        if (tail - head == RING_SLOTS) futex(&r->head, FUTEX_WAIT, head);
+        atomic_store(&r->producer_waiting, 0);
+    }
+    r->slot[tail % RING_SLOTS] = *msg;
+    atomic_store(&r->tail, tail + 1);   // seq_cst: ordered before the idle check
+    if (atomic_load(&r->consumer_idle) && atomic_exchange(&r->consumer_idle, 0))
+        futex(&r->tail, FUTEX_WAKE, 1);
+}
+
+// Process I, bulk mode: append n messages with a single tail update
+static void ring_push_n(struct ring *r, const struct message *msg, int n) {
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    for (int i = 0; i < n; i++) {
+        if (tail - r->head_cache == RING_SLOTS) {
+            atomic_store(&r->tail, tail);   // Full: publish what we have, then wait
+            if (atomic_load(&r->consumer_idle) && atomic_exchange(&r->consumer_idle, 0))
+                futex(&r->tail, FUTEX_WAKE, 1);
+            ring_push(r, &msg[i]);
+            tail++;
+            continue;
+        }
+        r->slot[tail++ % RING_SLOTS] = msg[i];
+    }
+    atomic_store(&r->tail, tail);
+    if (atomic_load(&r->consumer_idle) && atomic_exchange(&r->consumer_idle, 0))
+        futex(&r->tail, FUTEX_WAKE, 1);
+}
+
+// Consumer: take up to max messages, sleeping while the ring is empty
+static int ring_pop(struct ring *r, struct message *msg, int max) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while (head == r->tail_cache) {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head != r->tail_cache) break;
+        atomic_store(&r->consumer_idle, 1);
+        unsigned tail = atomic_load(&r->tail);
+        if (tail == head) futex(&r->tail, FUTEX_WAIT, tail);
+        atomic_store(&r->consumer_idle, 0);
+    }
+
+    int n = 0;
+    while (n < max && head != r->tail_cache) msg[n++] = r->slot[head++ % RING_SLOTS];
+    atomic_store(&r->head, head);       // seq_cst: ordered before the waiting check
+    if (atomic_load(&r->producer_waiting) && atomic_exchange(&r->producer_waiting, 0))
+        futex(&r->head, FUTEX_WAKE, 1);
+    return n;
+}
+
+// Process I: oldest position some ACTIVE subscriber still needs
+static uint64_t bus_min_cursor(uint64_t tail) {
+    uint64_t min = tail;
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        struct subscriber *sb = &bus->sub[i];
+        if (atomic_load(&sb->state) != SUB_ACTIVE) continue;
+        uint64_t c = atomic_load(&sb->cursor);
+        if (c < min) min = c;
+    }
+    return min;
+}
+
+// Process I: wait until position tail may be written
+static void bus_wait_room(uint64_t tail) {
+    while (tail - bus->min_cache >= LOG_SLOTS) {
+        bus->min_cache = bus_min_cursor(tail);
+        if (tail - bus->min_cache < LOG_SLOTS) break;
+
+        atomic_store(&bus->publisher_waiting, 1);
+        unsigned seq = atomic_load(&bus->read_seq);
+        bus->min_cache = bus_min_cursor(tail);
+        if (tail - bus->min_cache >= LOG_SLOTS && futex_wait_ms(&bus->read_seq, seq, 100) == -1 &&
+            errno == ETIMEDOUT) {
+            // Nobody moved for a while: evict subscribers that died without leaving
+            for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+                struct subscriber *sb = &bus->sub[i];
+                if (atomic_load(&sb->state) == SUB_ACTIVE && kill(sb->pid, 0) == -1 && errno == ESRCH) {
+                    printf("Process I: evicting subscriber PID %d (gone)\n", sb->pid);
+                    atomic_store(&sb->state, SUB_FREE);
+                }
+            }
+        }
+        atomic_store(&bus->publisher_waiting, 0);
+    }
+}
+
+// Process I: append n messages to the log, one tail update per batch
+static void bus_publish(const struct message *msg, int n) {
+    uint64_t tail = atomic_load_explicit(&bus->tail, memory_order_relaxed);
+    int quit = 0;
+    for (int i = 0; i < n; i++) {
+        if (tail - bus->min_cache >= LOG_SLOTS) {
+            atomic_store(&bus->tail, tail); // Let them read what is there first
+            if (atomic_load(&bus->sleepers) > 0) {
+                atomic_fetch_add(&bus->pub_seq, 1);
+                futex(&bus->pub_seq, FUTEX_WAKE, INT_MAX);
+            }
+            bus_wait_room(tail);
+        }
+        bus->log[tail++ % LOG_SLOTS] = msg[i];
+        if (msg[i].command == 'q') quit = 1;
+    }
+    atomic_store(&bus->tail, tail);     // seq_cst: ordered before the sleepers check
+    if (quit) atomic_store(&bus->closed, 1);
+    if (atomic_load(&bus->sleepers) > 0) {
+        atomic_fetch_add(&bus->pub_seq, 1);
+        futex(&bus->pub_seq, FUTEX_WAKE, INT_MAX);
+    }
+}
+
+// Subscriber: claim a table entry for the given topics; -1 if full
+static int bus_join(const char *topics) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        struct subscriber *sb = &bus->sub[i];
+        int expected = SUB_FREE;
+        if (!atomic_compare_exchange_strong(&sb->state, &expected, SUB_JOINING)) continue;
+        sb->pid = getpid();
+        memset(sb->topics, 0, sizeof(sb->topics));
+        for (const char *p = topics; *p; p++) sb->topics[(unsigned char)*p] = 1;
+        sb->topics['q'] = 1;
+        atomic_store(&sb->cursor, atomic_load(&bus->tail));
+        atomic_store(&sb->state, SUB_ACTIVE);
+        // Process I may have moved on before it saw us: start from what
+        // it has published since, which it cannot overwrite any more
+        atomic_store(&sb->cursor, atomic_load(&bus->tail));
+        return i;
+    }
+    return -1;
+}
+
+static void bus_wake_publisher(void) {
+    if (atomic_load(&bus->publisher_waiting)) {
+        atomic_fetch_add(&bus->read_seq, 1);
+        futex(&bus->read_seq, FUTEX_WAKE, 1);
+    }
+}
+
+static void bus_leave(int i) {
+    atomic_store(&bus->sub[i].state, SUB_FREE);
+    bus_wake_publisher();
+}
+
+// Bulk mode latency samples of this consumer or subscriber, ns
+static uint64_t *lat = NULL;
+static long n_lat = 0, lat_cap = 0;
+
+static void lat_add(uint64_t ns) {
+    if (n_lat == lat_cap) {
+        lat_cap = lat_cap ? 2 * lat_cap : 1024;
+        lat = realloc(lat, lat_cap * sizeof(uint64_t));
+    }
+    lat[n_lat++] = ns;
+}
+
+static volatile sig_atomic_t leaving = 0;
+
+// Subscriber i: up to max messages of its topics, sleeping while
+// there is nothing new; -1 once the bus is closed or on SIGINT.
+// Bulk mode: the log position says which messages carry a send time.
+static int bus_read(int i, struct message *msg, int max) {
+    struct subscriber *sb = &bus->sub[i];
+    uint64_t cursor = atomic_load_explicit(&sb->cursor, memory_order_relaxed);
+    uint64_t tail = atomic_load(&bus->tail);
+
+    while (cursor == tail) {
+        if (leaving || atomic_load(&bus->closed)) return -1;
+        atomic_fetch_add(&bus->sleepers, 1);
+        unsigned seq = atomic_load(&bus->pub_seq);
+        if (atomic_load(&bus->tail) == cursor && !atomic_load(&bus->closed))
+            futex_wait_ms(&bus->pub_seq, seq, 1000);
+        atomic_fetch_sub(&bus->sleepers, 1);
+        tail = atomic_load(&bus->tail);
+    }
+
+    int n = 0;
+    for (; n < max && cursor != tail; cursor++) {
+        struct message m = bus->log[cursor % LOG_SLOTS];
+        if (stats && cursor % LAT_EVERY == 0 && m.command != 'q') lat_add(now_ns() - stats->sent_ns[0][(cursor / LAT_EVERY) % LAT_SLOTS]);
+        if (sb->topics[(unsigned char)m.command]) msg[n++] = m;
+    }
+    atomic_store(&sb->cursor, cursor);
+    bus_wake_publisher();
+    return n;
+}
+
+// Consumer k: next messages from its channel; 0 = closed, -1 = error
+static int channel_read(int k, struct message *msg, int max) {
+    if (transport == TRANSPORT_SHM) return ring_pop(classes[k].ring, msg, max);
+    return read(classes[k].fd[0], msg, max * sizeof(struct message)) / (int)sizeof(struct message);
+}
+
+// Process I in shm mode does the dispatcher's routing itself: the
+// dispatch table picks the ring, 'q' goes into all of them
+static long shm_routed[MAX_CLASSES], shm_unroutable = 0;
+
+static void shm_send(const struct message *msg) {
+    if (msg->command == 'q') {
+        for (int k = 0; k < n_classes; k++) ring_push(classes[k].ring, msg);
+        return;
+    }
+    int k = route[(unsigned char)msg->command];
+    if (k == -1) {
+        shm_unroutable++;
+        return;
+    }
+    ring_push(classes[k].ring, msg);
+    shm_routed[k]++;
+}
+
+// Bulk mode output of Process I: a buffer per ring (shm), or one for
+// the FIFO, sent when full. FIFO writes of IO_BATCH messages are above
+// PIPE_BUF and may be split; the dispatcher reassembles messages.
+static struct message out_buf[MAX_CLASSES][IO_BATCH];
+static int out_len[MAX_CLASSES];
+static long sent_count[MAX_CLASSES];
+
+static void bulk_flush(int fd, int k) {
+    if (out_len[k] == 0) return;
+    if (transport == TRANSPORT_SHM) {
+        ring_push_n(classes[k].ring, out_buf[k], out_len[k]);
+    } else if (transport == TRANSPORT_BUS) {
+        bus_publish(out_buf[k], out_len[k]);
+    } else if (write(fd, out_buf[k], out_len[k] * sizeof(struct message)) == -1) {
+        perror("Process I: write");
+        exit(1);
+    }
+    out_len[k] = 0;
+}
+
+static void bulk_send(int fd, const struct message *msg) {
+    int k = route[(unsigned char)msg->command];
+    if (k != -1 && transport != TRANSPORT_BUS) {
+        // The consumer counts the same way: this is its message number
+        long j = sent_count[k]++;
+        if (j % LAT_EVERY == 0) stats->sent_ns[k][(j / LAT_EVERY) % LAT_SLOTS] = now_ns();
+    }
+    if (transport == TRANSPORT_BUS) {
+        // The log position is the sample index, whoever subscribes
+        long pos = sent_count[0]++;
+        if (pos % LAT_EVERY == 0) stats->sent_ns[0][(pos / LAT_EVERY) % LAT_SLOTS] = now_ns();
+        k = 0;
+    } else if (transport == TRANSPORT_SHM) {
+        if (k == -1) {
+            shm_unroutable++;
+            return;
+        }
+        shm_routed[k]++;
+    } else {
+        k = 0; // A single FIFO
+    }
+    out_buf[k][out_len[k]++] = *msg;
+    if (out_len[k] == IO_BATCH) bulk_flush(fd, k);
+}
+
+// Streams the script (one "C number" per line) or gen_count generated
+// commands, cycling through the classes, and then 'q'
+static long bulk_input(int fd) {
+    struct message msg;
+    long n = 0;
+
+    stats->start_ns = now_ns();
+    if (script) {
+        FILE *f = strcmp(script, "-") == 0 ? stdin : fopen(script, "r");
+        if (!f) {
+            perror("Process I: open script");
+            exit(1);
+        }
+        char line[64];
+        while (fgets(line, sizeof(line), f)) {
+            char *end;
+            char *p = line;
+            while (*p == ' ' || *p == '\t') p++;
+            if (*p == '\n' || *p == '\0' || *p == '#') continue;
+            msg.command = *p;
+            msg.number = strtol(p + 1, &end, 10);
+            if (end == p + 1) {
+                fprintf(stderr, "Process I: bad script line: %s", line);
+                continue;
+            }
+            if (msg.command == 'q') break;
+            bulk_send(fd, &msg);
+            n++;
+        }
+        if (f != stdin) fclose(f);
+    } else {
+        for (n = 0; n < gen_count; n++) {
+            msg.command = topic_list[n % n_topics];
+            msg.number = n;
+            bulk_send(fd, &msg);
+        }
+    }
+
+    // 'q' last, behind everything else on every channel
+    msg.command = 'q';
+    msg.number = 0;
+    if (transport == TRANSPORT_SHM) {
+        for (int k = 0; k < n_classes; k++) {
+            out_buf[k][out_len[k]++] = msg;
+            bulk_flush(fd, k);
+        }
+    } else {
+        out_buf[0][out_len[0]++] = msg;
+        bulk_flush(fd, 0);
+    }
+    return n;
+}
+
 void process_I() {
-    int fd;
+    int fd = -1;
     struct message msg;
     char cmd_char;
     int num;
 
-    printf("Process I (PID %d) started. Waiting for writer...\n", getpid());
+    printf("Process I (PID %d) started.\n", getpid());
     
-    fd = open(FIFO_NAME, O_WRONLY);
-    if (fd == -1) {
-        perror("Process I: open write");
-        exit(1);
+    if (transport == TRANSPORT_FIFO) {
+        printf("Process I: Waiting for reader...\n");
+        fd = open(FIFO_NAME, O_WRONLY);
+        if (fd == -1) {
+            perror("Process I: open write");
+            exit(1);
+        }
     }
-    printf("Process I: FIFO opened. Enter command (A, B, q) and a number (e.g., 'A 123'):\n");
 
-    while (1) {
-        if (scanf(" %c %d", &cmd_char, &num) != 2) {
-            while (getchar() != '\n');
+    if (BULK) {
+        printf("Process I: Streaming %s...\n", script ? script : "generated commands");
+        fflush(stdout);
+        long n = bulk_input(fd);
+        printf("Process I: Sent %ld commands and 'q' in %.3f s, terminating.\n",
+               n, (now_ns() - stats->start_ns) / 1e9);
+    } else {
+        printf("Process I: %s. Enter command (A, B, q) and a number (e.g., 'A 123'):\n",
+               transport == TRANSPORT_FIFO ? "FIFO opened" : transport == TRANSPORT_SHM ? "Rings mapped"
+                                                           : "Publishing on " BUS_NAME);
+    }
+
+    while (!BULK) {
+        int r = scanf(" %c %d", &cmd_char, &num);
+        if (r == EOF) { // End of input: same as 'q'
+            cmd_char = 'q';
+            num = 0;
+        } else if (r != 2) {
+            while ((r = getchar()) != '\n' && r != EOF);
             printf("Process I: Invalid input. Try again.\n");
             continue;
         }
@@ -41,7 +523,11 @@ void process_I() {
         msg.command = cmd_char;
         msg.number = num;
 
-        if (write(fd, &msg, sizeof(struct message)) == -1) {
+        if (transport == TRANSPORT_SHM) {
+            shm_send(&msg);
+        } else if (transport == TRANSPORT_BUS) {
+            bus_publish(&msg, 1);
+        } else if (write(fd, &msg, sizeof(struct message)) == -1) {
             perror("Process I: write");
             break; 
         }
@@ -51,97 +537,310 @@ void process_I() {
         }
     }
 
-    printf("Process I: Sent 'q', terminating.\n");
-    close(fd);
+    if (!BULK) printf("Process I: Sent 'q', terminating.\n");
+    if (transport == TRANSPORT_SHM) {
+        long total = shm_unroutable;
+        for (int k = 0; k < n_classes; k++) total += shm_routed[k];
+        printf("Process I: %ld messages, %ld unroutable.\n", total, shm_unroutable);
+        for (int k = 0; k < n_classes; k++)
+            printf("Process I: %ld routed to Process %c.\n", shm_routed[k], classes[k].command);
+    }
+    if (fd != -1) close(fd);
     exit(0);
 }
 
-void process_A() {
+// Reads the FIFO, the only process that does, and forwards every
+// message to the channel of the consumer that handles its command.
+// Messages are forwarded in arrival order, each channel gets one
+// write() per read() of the FIFO, and nothing is dropped: a slow
+// consumer makes its write block, and with it the dispatcher and
+// Process I (backpressure). 'q' goes to every consumer.
+void process_D() {
     int fd;
-    struct message msg;
-    int bytes_read;
+    struct message in[DISPATCH_BATCH];
+    struct message out[MAX_CLASSES][DISPATCH_BATCH];
+    int out_count[MAX_CLASSES] = { 0 };
+    long routed[MAX_CLASSES] = { 0 };
+    long total = 0, unroutable = 0;
+    int have = 0;   // Bytes of a partial message kept at the front of in
+    int quit = 0;
 
-    printf("Process A (PID %d) started. Waiting for reader...\n", getpid());
+    printf("Dispatcher (PID %d) started. Waiting for writer...\n", getpid());
 
     fd = open(FIFO_NAME, O_RDONLY);
     if (fd == -1) {
-        perror("Process A: open read");
+        perror("Dispatcher: open read");
         exit(1);
     }
-    printf("Process A: FIFO opened.\n");
-
-    while (1) {
+    printf("Dispatcher: FIFO opened, %d consumer channels.\n", n_classes);
 
-        bytes_read = read(fd, &msg, sizeof(struct message));
+    while (!quit) {
+        int bytes_read = read(fd, (char *)in + have, sizeof(in) - have);
 
         if (bytes_read <= 0) {
             if (bytes_read == 0) {
-                printf("Process A: Writer closed FIFO.\n");
+                printf("Dispatcher: Writer closed FIFO.\n");
             } else {
-                perror("Process A: read");
+                perror("Dispatcher: read");
             }
-            break; 
+            break;
         }
 
-        if (msg.command == 'q') {
-            break;
+        int n = (have + bytes_read) / sizeof(struct message);
+        for (int i = 0; i < n && !quit; i++) {
+            if (in[i].command == 'q') {
+                quit = 1;
+                break;
+            }
+            total++;
+            int k = route[(unsigned char)in[i].command];
+            if (k == -1) {
+                unroutable++;
+                continue;
+            }
+            out[k][out_count[k]++] = in[i];
+            routed[k]++;
         }
 
-        if (msg.command == 'A') {
-            printf("Process A: --- Received [A, %d]\n", msg.number);
-            fflush(stdout); 
+        // One write per channel for the whole batch
+        for (int k = 0; k < n_classes; k++) {
+            if (quit) out[k][out_count[k]++] = (struct message){ 'q', 0 };
+            if (out_count[k] == 0) continue;
+            if (write(classes[k].fd[1], out[k], out_count[k] * sizeof(struct message)) == -1) {
+                perror("Dispatcher: write");
+                exit(1);
+            }
+            out_count[k] = 0;
         }
+
+        have = (have + bytes_read) % sizeof(struct message);
+        memmove(in, (char *)in + n * sizeof(struct message), have);
     }
 
-    printf("Process A: Received 'q' or EOF, terminating.\n");
+    printf("Dispatcher: %ld messages read, %ld unroutable.\n", total, unroutable);
+    for (int k = 0; k < n_classes; k++)
+        printf("Dispatcher: %ld routed to Process %c.\n", routed[k], classes[k].command);
+    fflush(stdout);
+
     close(fd);
+    for (int k = 0; k < n_classes; k++) close(classes[k].fd[1]);
     exit(0);
 }
 
-void process_B() {
-    int fd;
-    struct message msg;
-    int bytes_read;
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
 
-    printf("Process B (PID %d) started. Waiting for reader...\n", getpid());
+static void print_latency(const char *who) {
+    if (n_lat == 0) return;
+    qsort(lat, n_lat, sizeof(uint64_t), cmp_u64);
+    printf("%s: latency from Process I, %ld samples: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           who, n_lat, lat[n_lat / 2] / 1e3, lat[(long)(n_lat * 0.99)] / 1e3, lat[n_lat - 1] / 1e3);
+}
 
-    fd = open(FIFO_NAME, O_RDONLY);
-    if (fd == -1) {
-        perror("Process B: open read");
-        exit(1);
-    }
-    printf("Process B: FIFO opened.\n");
+// Consumer of one command class, reading its own channel
+void process_consumer(int k) {
+    struct consumer_class *c = &classes[k];
+    struct message msg[DISPATCH_BATCH];
+    int n_read;
+    long delivered = 0, foreign = 0;
+    int quit = 0;
+    double first = 0, last = 0;
 
-    while (1) {
-        bytes_read = read(fd, &msg, sizeof(struct message));
+    printf("Process %c (PID %d) started.\n", c->command, getpid());
 
-        if (bytes_read <= 0) {
-            if (bytes_read == 0) {
-                printf("Process B: Writer closed FIFO.\n");
+    while (!quit) {
+        n_read = channel_read(k, msg, DISPATCH_BATCH);
+
+        if (n_read <= 0) {
+            if (n_read == 0) {
+                printf("Process %c: Dispatcher closed channel.\n", c->command);
             } else {
-                perror("Process B: read");
+                perror("Process: read");
             }
             break;
         }
+        if (first == 0) first = now_sec();
 
-        if (msg.command == 'q') {
-            break;
-        }
+        // Channel writes are whole messages, below PIPE_BUF: reads are too
+        for (int i = 0; i < n_read; i++) {
+            if (msg[i].command == 'q') {
+                quit = 1;
+                break;
+            }
 
-        if (msg.command == 'B') {
-            printf("Process B: +++ Received [B, %d]\n", msg.number);
-            fflush(stdout); 
+            if (msg[i].command == c->command && BULK) {
+                if (delivered % LAT_EVERY == 0)
+                    lat_add(now_ns() - stats->sent_ns[k][(delivered / LAT_EVERY) % LAT_SLOTS]);
+                delivered++;
+            } else if (msg[i].command == c->command) {
+                delivered++;
+                printf("Process %c: %s Received [%c, %d]\n", c->command, c->mark, c->command, msg[i].number);
+            } else {
+                foreign++; // Misrouted: must stay 0
+            }
         }
+        if (!BULK) fflush(stdout);
+        last = now_sec();
+    }
 
+    printf("Process %c: Received 'q' or EOF, terminating. %ld delivered, %ld misrouted.\n",
+           c->command, delivered, foreign);
+    if (delivered > 0 && last > first)
+        printf("Process %c: %.0f messages/s from the first message to the last (%s)\n",
+               c->command, delivered / (last - first), transport == TRANSPORT_SHM ? "shm" : "fifo");
+    char who[16];
+    snprintf(who, sizeof(who), "Process %c", c->command);
+    print_latency(who);
+    if (BULK) {
+        stats->delivered[k] = delivered;
+        stats->last_ns[k] = now_ns();
     }
+    free(lat);
+    if (transport == TRANSPORT_FIFO) close(c->fd[0]);
+    exit(0);
+}
 
-    printf("Process B: Received 'q' or EOF, terminating.\n");
-    close(fd);
+static void on_sigint(int sig) {
+    (void)sig;
+    leaving = 1;
+}
+
+// Bus subscriber for the given topics: one of the initial ones
+// (k = its index in classes, for the bulk statistics; main joined the
+// bus for it in slot i, so that it misses nothing) or one started by
+// hand with -s (k = -1), which may come and go at any time
+void process_subscriber(int k, int i, const char *topics) {
+    struct message msg[DISPATCH_BATCH];
+    long delivered = 0;
+    double first = 0, last = 0;
+    char who[32];
+
+    if (i == -1) i = bus_join(topics);
+    if (i == -1) {
+        fprintf(stderr, "Subscriber [%s]: bus full (%d subscribers)\n", topics, MAX_SUBSCRIBERS);
+        exit(1);
+    }
+    bus->sub[i].pid = getpid();
+    snprintf(who, sizeof(who), "Subscriber %d [%s]", i, topics);
+    printf("%s (PID %d) joined.\n", who, getpid());
+    fflush(stdout);
+
+    // Ctrl-C leaves the bus cleanly
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigint;
+    sigaction(SIGINT, &sa, NULL);
+
+    int quit = 0;
+    while (!quit) {
+        int n = bus_read(i, msg, DISPATCH_BATCH);
+        if (n < 0) break;
+        if (first == 0 && n > 0) first = now_sec();
+        for (int j = 0; j < n; j++) {
+            if (msg[j].command == 'q') {
+                quit = 1;
+                break;
+            }
+            delivered++;
+            if (!BULK) printf("%s: Received [%c, %d]\n", who, msg[j].command, msg[j].number);
+        }
+        if (!BULK && n > 0) fflush(stdout);
+        if (n > 0) last = now_sec();
+    }
+    bus_leave(i);
+
+    printf("%s: %s, leaving. %ld delivered.\n", who,
+           quit ? "Received 'q'" : leaving ? "Interrupted" : "Bus closed", delivered);
+    if (delivered > 0 && last > first)
+        printf("%s: %.0f messages/s from the first message to the last (bus)\n", who, delivered / (last - first));
+    print_latency(who);
+    if (BULK && k >= 0) {
+        stats->delivered[k] = delivered;
+        stats->last_ns[k] = now_ns();
+    }
+    free(lat);
     exit(0);
 }
 
-int main() {
-    pid_t pid_I, pid_A, pid_B;
+// -s: attach to the bus of a running publisher
+static void bus_attach(void) {
+    int fd = shm_open(BUS_NAME, O_RDWR, 0);
+    if (fd == -1) {
+        perror("shm_open " BUS_NAME " (is a publisher with -t bus running?)");
+        exit(1);
+    }
+    bus = mmap(NULL, sizeof(struct bus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (bus == MAP_FAILED) {
+        perror("mmap bus");
+        exit(1);
+    }
+    close(fd);
+}
+
+static void __attribute__((noreturn)) usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t fifo|shm] [-f script | -g count] "
+                    "[commands, at most %d distinct, not 'q' (default AB)]\n"
+                    "       %s -t bus [-f script | -g count] [topics,topics,... (default A,B)]\n"
+                    "       %s -s topics\n"
+                    "  -f script  stream commands from a file ('-' = stdin), one 'A 123' per line\n"
+                    "  -g count   stream count generated commands, one class after the other\n"
+                    "  -t bus     publish once into a shared log; one subscriber per topic list\n"
+                    "  -s topics  join the running bus as a subscriber of these commands\n",
+            prog, MAX_CLASSES, prog, prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    pid_t pid_I, pid_D;
+
+    int opt;
+    const char *join_topics = NULL;
+    while ((opt = getopt(argc, argv, "t:f:g:s:")) != -1) {
+        if (opt == 't' && strcmp(optarg, "fifo") == 0) transport = TRANSPORT_FIFO;
+        else if (opt == 't' && strcmp(optarg, "shm") == 0) transport = TRANSPORT_SHM;
+        else if (opt == 't' && strcmp(optarg, "bus") == 0) transport = TRANSPORT_BUS;
+        else if (opt == 'f') script = optarg;
+        else if (opt == 'g' && (gen_count = atol(optarg)) > 0) continue;
+        else if (opt == 's') join_topics = optarg;
+        else usage(argv[0]);
+    }
+    if (script && gen_count > 0) usage(argv[0]);
+
+    // A subscriber started by hand: no children, no FIFO
+    if (join_topics) {
+        if (BULK || optind < argc) usage(argv[0]);
+        bus_attach();
+        process_subscriber(-1, -1, join_topics);
+    }
+
+    // Command classes, one consumer each: "AB" unless given, e.g. "ABCD".
+    // Bus: topic lists, one subscriber each: "A,B" unless given, e.g. "AB,B,C"
+    memset(route, -1, sizeof(route));
+    if (transport == TRANSPORT_BUS) {
+        char *lists = strdup(optind < argc ? argv[optind] : "A,B");
+        for (char *t = strtok(lists, ","); t; t = strtok(NULL, ",")) {
+            if (n_classes == MAX_CLASSES || strchr(t, 'q')) usage(argv[0]);
+            classes[n_classes++].topics = t;
+            for (char *p = t; *p; p++) {
+                if (route[(unsigned char)*p] != -1) continue;
+                route[(unsigned char)*p] = n_topics;
+                topic_list[n_topics++] = *p;
+            }
+        }
+        if (n_classes == 0) usage(argv[0]);
+    } else {
+        const char *commands = optind < argc ? argv[optind] : "AB";
+        for (const char *p = commands; *p; p++) {
+            if (n_classes == MAX_CLASSES || *p == 'q' || route[(unsigned char)*p] != -1) usage(argv[0]);
+            route[(unsigned char)*p] = n_classes;
+            classes[n_classes].command = *p;
+            classes[n_classes].mark = marks[n_classes % (sizeof(marks) / sizeof(marks[0]))];
+            topic_list[n_topics++] = *p;
+            n_classes++;
+        }
+    }
 
     // Clean up any old FIFO file, ignoring error if it doesn't exist
     unlink(FIFO_NAME);
@@ -154,6 +853,50 @@ int main() {
     }
     printf("Parent: FIFO '%s' created.\n", FIFO_NAME);
 
+    if (BULK) {
+        stats = mmap(NULL, sizeof(struct bulk_stats), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (stats == MAP_FAILED) {
+            perror("main: mmap stats");
+            exit(1);
+        }
+    }
+
+    // Shared rings, mapped before any fork so that I and the consumers see them
+    if (transport == TRANSPORT_SHM) {
+        for (int k = 0; k < n_classes; k++) {
+            classes[k].ring = mmap(NULL, sizeof(struct ring), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (classes[k].ring == MAP_FAILED) {
+                perror("main: mmap ring");
+                exit(1);
+            }
+        }
+        printf("Parent: %d shared rings of %d messages mapped.\n", n_classes, RING_SLOTS);
+    }
+
+    // The bus, and a seat on it for each initial subscriber before
+    // anything is published
+    int bus_slot[MAX_CLASSES];
+    if (transport == TRANSPORT_BUS) {
+        shm_unlink(BUS_NAME);
+        int fd = shm_open(BUS_NAME, O_CREAT | O_EXCL | O_RDWR, 0666);
+        if (fd == -1 || ftruncate(fd, sizeof(struct bus)) == -1) {
+            perror("main: shm_open bus");
+            exit(1);
+        }
+        bus = mmap(NULL, sizeof(struct bus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (bus == MAP_FAILED) {
+            perror("main: mmap bus");
+            exit(1);
+        }
+        close(fd);
+        for (int k = 0; k < n_classes; k++) bus_slot[k] = bus_join(classes[k].topics);
+        printf("Parent: bus '%s' of %d messages created. More subscribers: %s -s <topics>\n",
+               BUS_NAME, LOG_SLOTS, argv[0]);
+    }
+    fflush(stdout); // Or every child would print it again
+
     // Fork Process I
     pid_I = fork();
     if (pid_I == -1) {
@@ -164,37 +907,82 @@ int main() {
         process_I();
     }
 
-    // Fork Process A
-    pid_A = fork();
-    if (pid_A == -1) {
-        perror("main: fork A");
-        exit(1);
+    // One channel per consumer
+    for (int k = 0; k < n_classes && transport == TRANSPORT_FIFO; k++) {
+        if (pipe(classes[k].fd) == -1) {
+            perror("main: pipe");
+            exit(1);
+        }
     }
-    if (pid_A == 0) {
-        process_A();
+
+    // Fork one consumer per class
+    for (int k = 0; k < n_classes; k++) {
+        classes[k].pid = fork();
+        if (classes[k].pid == -1) {
+            perror("main: fork consumer");
+            exit(1);
+        }
+        if (classes[k].pid == 0) {
+            // Keep only our read end, or EOF would never come
+            for (int j = 0; j < n_classes && transport == TRANSPORT_FIFO; j++) {
+                close(classes[j].fd[1]);
+                if (j != k) close(classes[j].fd[0]);
+            }
+            if (transport == TRANSPORT_BUS) process_subscriber(k, bus_slot[k], classes[k].topics);
+            process_consumer(k);
+        }
     }
 
-    // Fork Process B
-    pid_B = fork();
-    if (pid_B == -1) {
-        perror("main: fork B");
+    // Fork the Dispatcher (shm: Process I routes by itself)
+    pid_D = transport == TRANSPORT_FIFO ? fork() : 0;
+    if (transport == TRANSPORT_FIFO && pid_D == -1) {
+        perror("main: fork D");
         exit(1);
     }
-    if (pid_B == 0) {
-        process_B();
+    if (transport == TRANSPORT_FIFO && pid_D == 0) {
+        for (int k = 0; k < n_classes; k++) close(classes[k].fd[0]);
+        process_D();
     }
 
     // Parent process code
-    printf("Parent (PID %d): Started processes I (PID %d), A (PID %d), B (PID %d)\n",
-           getpid(), pid_I, pid_A, pid_B);
-    
-    // Wait for all three children to terminate
-    wait(NULL);
-    wait(NULL);
-    wait(NULL);
+    for (int k = 0; k < n_classes && transport == TRANSPORT_FIFO; k++) {
+        close(classes[k].fd[0]);
+        close(classes[k].fd[1]);
+    }
+    printf("Parent (PID %d): Started processes I (PID %d)", getpid(), pid_I);
+    if (transport == TRANSPORT_FIFO) printf(", D (PID %d)", pid_D);
+    for (int k = 0; k < n_classes; k++) {
+        if (transport == TRANSPORT_BUS) printf(", [%s] (PID %d)", classes[k].topics, classes[k].pid);
+        else printf(", %c (PID %d)", classes[k].command, classes[k].pid);
+    }
+    printf("\n");
+
+    // Wait for all children to terminate
+    while (wait(NULL) > 0);
 
     printf("Parent: All children terminated.\n");
 
+    if (BULK) {
+        long delivered = 0;
+        uint64_t end = stats->start_ns;
+        for (int k = 0; k < n_classes; k++) {
+            delivered += stats->delivered[k];
+            if (stats->last_ns[k] > end) end = stats->last_ns[k];
+        }
+        double elapsed = (end - stats->start_ns) / 1e9;
+        printf("Parent: %ld messages delivered end to end in %.3f s: %.0f messages/s (%s)\n",
+               delivered, elapsed, elapsed > 0 ? delivered / elapsed : 0.0,
+               transport == TRANSPORT_SHM ? "shm" : transport == TRANSPORT_BUS ? "bus" : "fifo");
+        if (transport == TRANSPORT_BUS)
+            printf("Parent: %llu messages published once each into the log\n",
+                   (unsigned long long)atomic_load(&bus->tail) - 1);
+    }
+
+    if (transport == TRANSPORT_BUS) {
+        munmap(bus, sizeof(struct bus));
+        shm_unlink(BUS_NAME);
+    }
+
     // Clean up the FIFO
     if (unlink(FIFO_NAME) == -1) {
         perror("main: unlink");
@@ -5,6 +5,17 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <signal.h>
+
+#define MAX_BATCH 4096  // Coordinates taken per read()
 
 struct DataCoord {
     int x_coor;
@@ -12,43 +23,536 @@ struct DataCoord {
     char command;
 };
 
-int main()
-{
-    int fd;
-    struct DataCoord msg;
+// Where the picture goes. The terminal through ncurses, or ("-H") an
+// in-memory grid with no terminal at all, summed up at exit as a
+// checksum and optionally written out as an image (-o).
+struct Renderer {
+    void (*open)(int rows, int cols);               // Size hint, the terminal has its own
+    void (*point)(int y, int x);                    // One '*'
+    void (*row)(int y, const char *cells, int n);   // A row from a canvas
+    void (*status)(const char *text);               // Row 0
+    void (*present)(void);                          // End of a frame
+    void (*close)(void);
+};
 
-    // Open FIFO for reading
-    fd = open("/tmp/my_drawing_pipe", O_RDONLY);
-    if (fd == -1) {
-        perror("ConsumerB: open failed");
-        exit(1);
-    }
+static int screen_rows, screen_cols;
 
-    // Start ncurses
+static void curses_open(int rows, int cols)
+{
+    (void)rows;
+    (void)cols;
     initscr();
     cbreak();
     noecho();
+    screen_rows = LINES;
+    screen_cols = COLS;
+}
+
+static void curses_point(int y, int x) { mvaddch(y, x, '*'); }
+static void curses_row(int y, const char *cells, int n) { mvaddnstr(y, 0, cells, n); }
+static void curses_status(const char *text) { mvaddstr(0, 0, text); }
+static void curses_present(void) { refresh(); }
+static void curses_close(void) { endwin(); }
 
-    mvprintw(0, 0, "Consumer B: Mirroring Producer A.");
-    refresh();
+static const struct Renderer curses_renderer = {
+    curses_open, curses_point, curses_row, curses_status, curses_present, curses_close
+};
+
+static char *grid; // screen_rows * screen_cols, ' ' or '*'
+static long grid_clipped; // Points outside the grid, reported at exit
+
+static void grid_open(int rows, int cols)
+{
+    screen_rows = rows;
+    screen_cols = cols;
+    grid = malloc((size_t)rows * cols);
+    memset(grid, ' ', (size_t)rows * cols);
+}
+
+static void grid_point(int y, int x)
+{
+    if ((unsigned)y < (unsigned)screen_rows && (unsigned)x < (unsigned)screen_cols)
+        grid[y * screen_cols + x] = '*';
+    else
+        grid_clipped++;
+}
+
+static void grid_row(int y, const char *cells, int n)
+{
+    memcpy(&grid[y * screen_cols], cells, n);
+}
+
+static void grid_status(const char *text) { (void)text; } // Not part of the picture
+static void grid_present(void) {}
+static void grid_close(void) {}
+
+static const struct Renderer grid_renderer = {
+    grid_open, grid_point, grid_row, grid_status, grid_present, grid_close
+};
+
+static const struct Renderer *render = &curses_renderer;
+
+// FNV-1a over the grid: equal pictures, equal sums
+static uint64_t grid_checksum(long *marked)
+{
+    uint64_t h = 14695981039346656037ull;
+    *marked = 0;
+    for (long i = 0; i < (long)screen_rows * screen_cols; i++) {
+        h = (h ^ (unsigned char)grid[i]) * 1099511628211ull;
+        *marked += grid[i] == '*';
+    }
+    return h;
+}
+
+// Binary PBM, one bit per cell, '*' black
+static int grid_write_pbm(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) return -1;
+    fprintf(f, "P4\n%d %d\n", screen_cols, screen_rows);
+    int row_bytes = (screen_cols + 7) / 8;
+    unsigned char *bits = calloc(row_bytes, 1);
+    for (int y = 0; y < screen_rows; y++) {
+        memset(bits, 0, row_bytes);
+        for (int x = 0; x < screen_cols; x++)
+            if (grid[y * screen_cols + x] == '*') bits[x / 8] |= 0x80 >> (x % 8);
+        fwrite(bits, 1, row_bytes, f);
+    }
+    free(bits);
+    return fclose(f);
+}
 
-    while (1) {
-        ssize_t n = read(fd, &msg, sizeof(msg));
+// Shared canvas ("-c"), same layout in ProducerA.c
+#define CANVAS_NAME "/my_drawing_canvas"
+#define CANVAS_MAX_ROWS 1024
 
-        if (n <= 0) {
-            break; // EOF or error
+struct Canvas {
+    int rows, cols;
+    atomic_uint generation;                         // Moves drawn so far
+    atomic_ullong dirty[CANVAS_MAX_ROWS / 64];      // One bit per row
+    char cells[];                                   // rows * cols, ' ' or '*'
+};
+
+static struct Canvas *canvas_open(void)
+{
+    int shm = shm_open(CANVAS_NAME, O_RDWR, 0);
+    struct stat st;
+    if (shm == -1 || fstat(shm, &st) == -1) {
+        perror("ConsumerB: shm_open canvas failed (ProducerA not started with -c?)");
+        exit(1);
+    }
+    struct Canvas *c = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    close(shm);
+    if (c == MAP_FAILED) {
+        perror("ConsumerB: mmap canvas failed");
+        exit(1);
+    }
+    shm_unlink(CANVAS_NAME); // Both sides have it mapped now
+    return c;
+}
+
+// Copies the rows changed since the last call into the screen model;
+// returns how many there were. A bit is cleared before its row is
+// read, so a move that lands meanwhile sets it again for next time.
+static long canvas_sync(struct Canvas *c)
+{
+    long rows = 0;
+    int width = c->cols < screen_cols ? c->cols : screen_cols;
+    for (int w = 0; w * 64 < c->rows; w++) {
+        uint64_t bits = atomic_exchange(&c->dirty[w], 0);
+        while (bits) {
+            int y = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (y == 0 || y >= screen_rows) continue; // Row 0 is our status line
+            render->row(y, &c->cells[y * c->cols], width);
+            rows++;
         }
+    }
+    return rows;
+}
+
+// Broadcast bus ("-b"), same layout in ProducerA.c. The cursor is ours
+// alone: attaching and detaching never touch the producer's path.
+#define BUS_NAME "/my_drawing_bus"
+#define BUS_SLOTS 65536 // Power of two
+
+struct Bus {
+    atomic_ulong tail;                  // Moves published so far
+    atomic_int closed;                  // ProducerA quit, no more moves
+    atomic_int viewers;                 // Attached right now
+    atomic_int ready;                   // Canvas initialised, set last
+    pid_t producer;                     // A bus whose producer died is closed too
+    struct DataCoord log[BUS_SLOTS];    // Move n is in log[n % BUS_SLOTS]
+    // struct Canvas follows (the snapshot)
+};
 
-        if (msg.command == 'q') {
-            break; // Quit
+static struct Canvas *bus_canvas(struct Bus *b)
+{
+    return (struct Canvas *)(b + 1);
+}
+
+// ProducerA quit with 'q', or died some other way (its xterm closed,
+// a signal) without getting to say so
+static int bus_closed(struct Bus *b)
+{
+    return atomic_load(&b->closed) || kill(b->producer, 0) == -1;
+}
+
+// Waits up to ten seconds for ProducerA -b to create the bus and mark
+// it ready; skips a bus left behind by an earlier run that did not get
+// to unlink it
+static struct Bus *bus_attach(void)
+{
+    for (int tries = 0; tries < 100; tries++, usleep(100000)) {
+        int shm = shm_open(BUS_NAME, O_RDWR, 0);
+        struct stat st;
+        if (shm == -1) continue;
+        if (fstat(shm, &st) == -1 || (size_t)st.st_size <= sizeof(struct Bus)) {
+            close(shm); // Not sized yet
+            continue;
+        }
+        struct Bus *b = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+        close(shm);
+        if (b == MAP_FAILED) break;
+        if (!atomic_load_explicit(&b->ready, memory_order_acquire)) {
+            munmap(b, st.st_size); // Canvas not initialised yet
+            continue;
         }
+        if (!bus_closed(b)) {
+            atomic_fetch_add(&b->viewers, 1);
+            return b;
+        }
+        munmap(b, st.st_size);
+    }
+    perror("ConsumerB: no bus (ProducerA not started with -b?)");
+    exit(1);
+}
 
-        mvaddch(msg.y_coor, msg.x_coor, '*');
-        refresh();
+// Redraws the whole picture from the canvas; returns the log position
+// it covers. Cells drawn after that are drawn again from the log.
+static unsigned long bus_snapshot(struct Bus *b)
+{
+    struct Canvas *c = bus_canvas(b);
+    unsigned long t = atomic_load_explicit(&b->tail, memory_order_acquire);
+    int rows = c->rows < screen_rows ? c->rows : screen_rows;
+    int width = c->cols < screen_cols ? c->cols : screen_cols;
+    for (int y = 1; y < rows; y++) // Row 0 is our status line
+        render->row(y, &c->cells[y * c->cols], width);
+    return t;
+}
+
+// Draws the moves from *cursor up to tail; returns how many, or -1 if
+// the producer lapped us meanwhile and the snapshot has to be taken
+static long bus_follow(struct Bus *b, unsigned long *cursor)
+{
+    unsigned long t = atomic_load_explicit(&b->tail, memory_order_acquire);
+    unsigned long c = *cursor;
+    if (t - c >= BUS_SLOTS) return -1;
+    for (unsigned long n = c; n < t; n++) {
+        struct DataCoord *m = &b->log[n % BUS_SLOTS];
+        render->point(m->y_coor, m->x_coor);
     }
+    // Slot n is rewritten once tail reaches n + BUS_SLOTS
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&b->tail, memory_order_relaxed) - c >= BUS_SLOTS) return -1;
+    *cursor = t;
+    return t - c;
+}
+
+// Latency board of ReplayerR, same layout in ReplayerR.c. Point n was
+// written to the FIFO at sent_ns[n % LAT_SLOTS]; we take the time from
+// there to drawing it into the screen model (the terminal is refreshed
+// up to one frame later).
+#define LATENCY_NAME "/my_drawing_latency"
+#define LAT_SLOTS 65536
+
+struct Latency {
+    pid_t replayer;                 // A board left by a dead replay is ignored
+    int rows, cols;                 // Of the trace, the headless grid takes them
+    atomic_int done;                // We got the 'q'
+    long received;                  // Points we drew
+    uint64_t last_ns;               // When we got the 'q'
+    uint64_t sent_ns[LAT_SLOTS];
+};
+
+static struct Latency *latency_open(void)
+{
+    int shm = shm_open(LATENCY_NAME, O_RDWR, 0);
+    if (shm == -1) return NULL; // ProducerA, not a replay
+    struct Latency *l = mmap(NULL, sizeof(*l), PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    close(shm);
+    if (l == MAP_FAILED) return NULL;
+    if (kill(l->replayer, 0) == -1) {
+        munmap(l, sizeof(*l));
+        return NULL;
+    }
+    return l;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Replay latency samples, ns
+static uint64_t *lat = NULL;
+static long n_lat = 0, lat_cap = 0;
+
+static void lat_add(uint64_t ns)
+{
+    if (n_lat == lat_cap) {
+        lat_cap = lat_cap ? 2 * lat_cap : 1024;
+        lat = realloc(lat, lat_cap * sizeof(uint64_t));
+    }
+    lat[n_lat++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static volatile sig_atomic_t detach;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    detach = 1;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Usage: ConsumerB [-c | -b] [-H [-o image.pbm]] [frames per second (default 60)]
+// Every coordinate waiting in the FIFO is drawn into the curses
+// screen model as soon as it arrives, but the terminal is only
+// refreshed on the frame timer, and only if something changed.
+// -c: the picture comes from the shared canvas instead, whose dirty
+// rows are copied once per frame; the FIFO only brings the 'q'.
+// -b: one of any number of viewers on ProducerA's broadcast bus, with
+// no FIFO; it can be started late and closed early (Ctrl-C) at will.
+// -H: headless, draw into memory only. The grid is the size of the
+// canvas, the replayed trace or the screen ProducerA reports first on
+// the FIFO ('S'); -o saves it.
+// Fed by ReplayerR instead of ProducerA, it also reports the latency.
+int main(int argc, char *argv[])
+{
+    int fd = -1;
+    static struct DataCoord batch[MAX_BATCH];
+    struct Canvas *canvas = NULL;
+    struct Bus *bus = NULL;
+    int use_canvas = 0, use_bus = 0, opt;
+    const char *image = NULL;
+
+    while ((opt = getopt(argc, argv, "cbHo:")) != -1) {
+        switch (opt) {
+            case 'c': use_canvas = 1; break;
+            case 'b': use_bus = 1; break;
+            case 'H': render = &grid_renderer; break;
+            case 'o': image = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-c | -b] [-H [-o image.pbm]] [fps]\n", argv[0]);
+                exit(1);
+        }
+    }
+    int fps = optind < argc ? atoi(argv[optind]) : 60;
+    if (fps < 1) fps = 60;
+
+    // Attach to the bus, or open FIFO for reading
+    if (use_bus) {
+        bus = bus_attach();
+        struct sigaction sa = { .sa_handler = on_signal }; // No SA_RESTART: poll returns
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        sigaction(SIGHUP, &sa, NULL);
+    } else {
+        fd = open("/tmp/my_drawing_pipe", O_RDONLY);
+        if (fd == -1) {
+            perror("ConsumerB: open failed");
+            exit(1);
+        }
+    }
+    struct Latency *replay = use_bus ? NULL : latency_open();
+
+    // ProducerA starts with its screen size; ReplayerR has it on the
+    // latency board instead and sends moves only
+    struct DataCoord first = { 0, 0, 0 };
+    if (fd != -1 && !use_canvas && !replay &&
+        read(fd, &first, sizeof(first)) != sizeof(first))
+        first.command = 0;
+    if (fd != -1) fcntl(fd, F_SETFL, O_NONBLOCK); // Drain until EAGAIN
+
+    // ProducerA created it before opening its end of the FIFO
+    if (use_canvas) canvas = canvas_open();
+
+    // Frame clock
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (tfd == -1) {
+        perror("ConsumerB: timerfd_create failed");
+        exit(1);
+    }
+    long period_ns = 1000000000L / fps;
+    struct timespec period = { period_ns / 1000000000L, period_ns % 1000000000L };
+    struct itimerspec frame = { period, period };
+    timerfd_settime(tfd, 0, &frame, NULL);
+
+    // Start ncurses, or the grid
+    if (bus) render->open(bus_canvas(bus)->rows, bus_canvas(bus)->cols);
+    else if (canvas) render->open(canvas->rows, canvas->cols);
+    else if (replay) render->open(replay->rows, replay->cols);
+    else if (first.command == 'S') render->open(first.y_coor, first.x_coor);
+    else render->open(24, 80);
+
+    render->status("Consumer B: Mirroring Producer A.");
+    render->present();
+
+    long snapshots = 0;
+    unsigned long cursor = 0;
+    if (bus) {
+        cursor = bus_snapshot(bus); // Late joiner: the picture so far
+        snapshots++;
+    }
+
+    long points = 0, frames = 0, reads = 0, max_batch = 0, rows_drawn = 0;
+    unsigned last_gen = 0;
+    long points_sec = 0, frames_sec = 0;   // Last second, for the status line
+    double start = now_sec(), sec_start = start;
+    int dirty = 0, quit = 0;
+    if (first.command == 'M') { // No size first: an older producer
+        render->point(first.y_coor, first.x_coor);
+        points++;
+    }
+    struct pollfd pfd[2] = { { fd, POLLIN, 0 }, { tfd, POLLIN, 0 } };
 
-    close(fd);
-    endwin();
+    while (!quit && !detach) {
+        if (poll(pfd, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // All pending coordinates, whole structs only: every write is one
+        // struct, below PIPE_BUF, and the batch is a multiple of it
+        while (pfd[0].revents && !quit) {
+            ssize_t n = read(fd, batch, sizeof(batch));
+            if (n == -1 && errno == EAGAIN) break;
+            if (n <= 0) {
+                quit = 1; // EOF or error
+                break;
+            }
+            int count = n / sizeof(struct DataCoord);
+            reads++;
+            if (count > max_batch) max_batch = count;
+            uint64_t arrived = replay ? now_ns() : 0;
+
+            for (int i = 0; i < count; i++) {
+                if (batch[i].command == 'q') {
+                    quit = 1; // Quit
+                    break;
+                }
+                if (batch[i].command != 'M') continue; // The size, in canvas mode
+                render->point(batch[i].y_coor, batch[i].x_coor);
+                if (replay) lat_add(arrived - replay->sent_ns[points % LAT_SLOTS]);
+                points++;
+                points_sec++;
+                dirty = 1;
+            }
+        }
+
+        if (pfd[1].revents) {
+            uint64_t expirations;
+            if (read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
+
+            // Canvas: one generation per move, the dirty rows hold them all
+            if (canvas && atomic_load(&canvas->generation) != last_gen) {
+                unsigned gen = atomic_load(&canvas->generation);
+                points += gen - last_gen;
+                points_sec += gen - last_gen;
+                last_gen = gen;
+                rows_drawn += canvas_sync(canvas);
+                dirty = 1;
+            }
+
+            // Bus: every move since our cursor, or the snapshot again
+            if (bus) {
+                int closed = bus_closed(bus);
+                long n = bus_follow(bus, &cursor);
+                if (n == -1) {
+                    cursor = bus_snapshot(bus);
+                    snapshots++;
+                    dirty = 1;
+                } else if (n > 0) {
+                    points += n;
+                    points_sec += n;
+                    dirty = 1;
+                }
+                if (closed) quit = 1; // Read after closed: nothing left behind
+            }
+
+            double t = now_sec();
+            if (t - sec_start >= 1.0) {
+                char line[128];
+                snprintf(line, sizeof(line), "Consumer B: Mirroring Producer A. %ld points/s, %ld fps   ",
+                         (long)(points_sec / (t - sec_start)), (long)(frames_sec / (t - sec_start)));
+                render->status(line);
+                points_sec = frames_sec = 0;
+                sec_start = t;
+                dirty = 1;
+            }
+            if (dirty) {
+                render->present();
+                frames++;
+                frames_sec++;
+                dirty = 0;
+            }
+        }
+    }
+    if (canvas && atomic_load(&canvas->generation) != last_gen) {
+        points += atomic_load(&canvas->generation) - last_gen;
+        rows_drawn += canvas_sync(canvas);
+        dirty = 1;
+    }
+    if (dirty) render->present();
+    if (bus) atomic_fetch_sub(&bus->viewers, 1);
+    if (replay) {
+        replay->last_ns = now_ns();
+        replay->received = points;
+        atomic_store(&replay->done, 1);
+    }
+
+    double elapsed = now_sec() - start;
+    close(tfd);
+    if (fd != -1) close(fd);
+    render->close();
     printf("Consumer B terminated.\n");
+    printf("Consumer B: %ld points in %.3f s (%.0f points/s), %ld reads (up to %ld points each), "
+           "%ld frames (%.1f fps, target %d)\n",
+           points, elapsed, points / elapsed, reads, max_batch, frames, frames / elapsed, fps);
+    if (canvas)
+        printf("Consumer B: shared canvas %dx%d, %ld rows redrawn (%.1f per frame)\n",
+               canvas->cols, canvas->rows, rows_drawn, frames ? (double)rows_drawn / frames : 0.0);
+    if (n_lat) {
+        qsort(lat, n_lat, sizeof(uint64_t), cmp_u64);
+        printf("Consumer B: replay latency, %ld points: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+               n_lat, lat[n_lat / 2] / 1e3, lat[(long)(n_lat * 0.99)] / 1e3, lat[n_lat - 1] / 1e3);
+    }
+    if (render == &grid_renderer) {
+        long marked;
+        uint64_t sum = grid_checksum(&marked);
+        printf("Consumer B: headless grid %dx%d, %ld cells drawn, checksum %016llx",
+               screen_cols, screen_rows, marked, (unsigned long long)sum);
+        if (grid_clipped) printf(", %ld points outside the grid dropped", grid_clipped);
+        printf("\n");
+        if (image && grid_write_pbm(image) != 0) perror("ConsumerB: cannot write image");
+    }
+    if (bus)
+        printf("Consumer B: bus viewer, %s at move %lu, %ld snapshots taken\n",
+               detach ? "detached" : "closed", cursor, snapshots);
     return 0;
 }
@@ -20,8 +20,41 @@ int spawn(const char * program, char ** arg_list)
     }
 }
 
-int main()
+// Usage: LauncherP [-H] [-c | -b viewers | -p trace [speed]]
+// -c: ProducerA and ConsumerB share a canvas in memory instead of
+// sending every move through the FIFO
+// -b: ProducerA publishes on a broadcast bus mirrored by that many
+// ConsumerB viewers (more can be started by hand: ./ConsumerB -b)
+// -p: ReplayerR plays a trace recorded by ProducerA -r in place of
+// ProducerA, here in this terminal, at the given speed (0: flat out)
+// -H: no xterm. ConsumerB draws headless (ConsumerB -H) and reports a
+// checksum of the picture; ProducerA, if not replaying, runs here.
+int main(int argc, char *argv[])
 {
+    char *mode = NULL, *trace = NULL, *speed = NULL;
+    int viewers = 1, headless = 0, opt;
+
+    while ((opt = getopt(argc, argv, "cb:p:H")) != -1) {
+        switch (opt) {
+            case 'c': mode = "-c"; break;
+            case 'b':
+                mode = "-b";
+                viewers = atoi(optarg);
+                if (viewers < 1) viewers = 1;
+                break;
+            case 'p': trace = optarg; break;
+            case 'H': headless = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-H] [-c | -b viewers | -p trace [speed]]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (trace) {
+        mode = NULL; // ReplayerR only speaks FIFO
+        viewers = 1; // More readers would split the points between them
+        speed = optind < argc ? argv[optind] : "1";
+    }
+
     const char* fifo = "/tmp/my_drawing_pipe";
     unlink(fifo);
 
@@ -32,14 +65,24 @@ int main()
 
     sleep(1); // give time for FIFO to be ready
 
-    char* argA[] = { "xterm", "-hold", "-e", "./ProducerA", NULL };
-    char* argB[] = { "xterm", "-hold", "-e", "./ConsumerB", NULL };
+    char* argA[] = { "xterm", "-hold", "-e", "./ProducerA", mode, NULL };
+    char* argB[] = { "xterm", "-hold", "-e", "./ConsumerB", mode, NULL };
+    char* argR[] = { "./ReplayerR", trace, speed, NULL };
+    char* argHA[] = { "./ProducerA", mode, NULL };
+    char* argHB[] = { "./ConsumerB", "-H", mode, NULL };
 
-    pid_t pidA = spawn("xterm", argA);
-    pid_t pidB = spawn("xterm", argB);
+    pid_t pidA;
+    if (trace) pidA = spawn("./ReplayerR", argR);
+    else if (headless) pidA = spawn("./ProducerA", argHA);
+    else pidA = spawn("xterm", argA);
+    pid_t *pidB = malloc(viewers * sizeof(pid_t));
+    for (int i = 0; i < viewers; i++)
+        pidB[i] = headless ? spawn("./ConsumerB", argHB) : spawn("xterm", argB);
 
     waitpid(pidA, NULL, 0);
-    waitpid(pidB, NULL, 0);
+    for (int i = 0; i < viewers; i++)
+        waitpid(pidB[i], NULL, 0);
+    free(pidB);
 
     unlink(fifo);
     return 0;
@@ -5,6 +5,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <time.h>
 
 struct DataCoord {
     int x_coor;
@@ -12,19 +17,187 @@ struct DataCoord {
     char command;
 };
 
-int main()
+// Shared canvas ("-c"), same layout in ConsumerB.c. The producer draws
+// into cells, marks the row in the dirty bitmap, then bumps generation;
+// the consumer redraws only dirty rows, once per frame.
+#define CANVAS_NAME "/my_drawing_canvas"
+#define CANVAS_MAX_ROWS 1024
+
+struct Canvas {
+    int rows, cols;
+    atomic_uint generation;                         // Moves drawn so far
+    atomic_ullong dirty[CANVAS_MAX_ROWS / 64];      // One bit per row
+    char cells[];                                   // rows * cols, ' ' or '*'
+};
+
+static void *shm_create(const char *name, size_t size)
+{
+    shm_unlink(name); // A stale one from an earlier run
+    int shm = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (shm == -1 || ftruncate(shm, size) == -1) {
+        perror("ProducerA: shm_open failed");
+        exit(1);
+    }
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    close(shm);
+    if (p == MAP_FAILED) {
+        perror("ProducerA: mmap failed");
+        exit(1);
+    }
+    return p;
+}
+
+static void canvas_init(struct Canvas *c, int rows, int cols)
+{
+    c->rows = rows;
+    c->cols = cols;
+    memset(c->cells, ' ', (size_t)rows * cols);
+}
+
+static struct Canvas *canvas_create(int rows, int cols)
+{
+    if (rows > CANVAS_MAX_ROWS) rows = CANVAS_MAX_ROWS;
+    struct Canvas *c = shm_create(CANVAS_NAME, sizeof(struct Canvas) + (size_t)rows * cols);
+    canvas_init(c, rows, cols);
+    return c;
+}
+
+static void canvas_draw(struct Canvas *c, int y, int x)
+{
+    if (y >= c->rows || x >= c->cols) return;
+    c->cells[y * c->cols + x] = '*';
+    atomic_fetch_or(&c->dirty[y / 64], 1ull << (y % 64));
+    atomic_fetch_add(&c->generation, 1);
+}
+
+// Broadcast bus ("-b"), same layout in ConsumerB.c. Every move goes to
+// an append log that any number of viewers read with their own cursor,
+// and into a canvas that serves as the snapshot for late joiners. The
+// producer never looks at the viewers: a move costs one log slot, one
+// cell and one store of tail however many are attached. A viewer that
+// falls a whole log behind starts again from the snapshot.
+#define BUS_NAME "/my_drawing_bus"
+#define BUS_SLOTS 65536 // Power of two
+
+struct Bus {
+    atomic_ulong tail;                  // Moves published so far
+    atomic_int closed;                  // ProducerA quit, no more moves
+    atomic_int viewers;                 // Attached right now
+    atomic_int ready;                   // Canvas initialised, set last
+    pid_t producer;                     // A bus whose producer died is closed too
+    struct DataCoord log[BUS_SLOTS];    // Move n is in log[n % BUS_SLOTS]
+    // struct Canvas follows (the snapshot)
+};
+
+static struct Canvas *bus_canvas(struct Bus *b)
+{
+    return (struct Canvas *)(b + 1);
+}
+
+static struct Bus *bus_create(int rows, int cols)
+{
+    if (rows > CANVAS_MAX_ROWS) rows = CANVAS_MAX_ROWS;
+    struct Bus *b = shm_create(BUS_NAME, sizeof(struct Bus) + sizeof(struct Canvas) +
+                                         (size_t)rows * cols);
+    canvas_init(bus_canvas(b), rows, cols);
+    b->producer = getpid();
+    atomic_store_explicit(&b->ready, 1, memory_order_release); // Viewers may use it now
+    return b;
+}
+
+// The cell is drawn before tail is published, so a viewer that copies
+// the canvas after reading tail has every move before it
+static void bus_publish(struct Bus *b, int y, int x)
+{
+    unsigned long t = atomic_load_explicit(&b->tail, memory_order_relaxed);
+    struct DataCoord *slot = &b->log[t % BUS_SLOTS];
+    slot->x_coor = x;
+    slot->y_coor = y;
+    slot->command = 'M';
+    canvas_draw(bus_canvas(b), y, x);
+    atomic_store_explicit(&b->tail, t + 1, memory_order_release);
+}
+
+static void bus_close(struct Bus *b)
+{
+    atomic_store(&b->closed, 1);
+    shm_unlink(BUS_NAME); // No new viewers; attached ones drain and exit
+}
+
+// Trace file ("-r"), same format in ReplayerR.c: a header, then one
+// 8-byte record per move sent, with the time since the one before
+#define TRACE_MAGIC 0x52544344 // "DCTR"
+
+struct TraceHeader {
+    uint32_t magic;
+    uint16_t rows, cols;
+};
+
+struct TracePoint {
+    uint32_t dt_us;
+    uint16_t x, y;
+};
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static FILE *trace_file;
+static uint64_t trace_last_us;
+static long trace_points;
+
+static void trace_open(const char *path, int rows, int cols)
+{
+    trace_file = fopen(path, "wb");
+    struct TraceHeader h = { TRACE_MAGIC, rows, cols };
+    if (trace_file == NULL || fwrite(&h, sizeof(h), 1, trace_file) != 1) {
+        endwin();
+        perror("ProducerA: cannot write trace");
+        exit(1);
+    }
+    trace_last_us = now_us();
+}
+
+static void trace_add(int y, int x)
+{
+    uint64_t t = now_us();
+    uint64_t dt = t - trace_last_us;
+    struct TracePoint p = { dt > UINT32_MAX ? UINT32_MAX : dt, x, y };
+    fwrite(&p, sizeof(p), 1, trace_file); // stdio buffers it
+    trace_last_us = t;
+    trace_points++;
+}
+
+// Usage: ProducerA [-c | -b] [-r trace]
+// -c: draw into the shared canvas instead of sending every move; the
+// FIFO then only carries the final 'q'
+// -b: publish to the broadcast bus for any number of ConsumerB -b
+// viewers; the FIFO is not used
+// -r: also record every move to a trace file, for ReplayerR
+int main(int argc, char *argv[])
 {
     int x, y, ch, fd;
     struct DataCoord msg;
+    struct Canvas *canvas = NULL;
+    struct Bus *bus = NULL;
+    int use_canvas = 0, use_bus = 0, opt;
+    const char *trace_path = NULL;
 
-    // Open FIFO for writing
-    fd = open("/tmp/my_drawing_pipe", O_WRONLY);
-    if (fd == -1) {
-        perror("ProducerA: open failed");
-        exit(1);
+    while ((opt = getopt(argc, argv, "cbr:")) != -1) {
+        switch (opt) {
+            case 'c': use_canvas = 1; break;
+            case 'b': use_bus = 1; break;
+            case 'r': trace_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-c | -b] [-r trace]\n", argv[0]);
+                exit(1);
+        }
     }
 
-    // Start ncurses
+    // Start ncurses (before the FIFO: the canvas is sized to this terminal)
     initscr();
     cbreak();
     keypad(stdscr, TRUE);
@@ -33,11 +206,43 @@ int main()
     int max_y, max_x;
     getmaxyx(stdscr, max_y, max_x);
 
+    // Ready before the FIFO opens, so ConsumerB finds it
+    if (use_canvas) canvas = canvas_create(max_y, max_x);
+    if (use_bus) bus = bus_create(max_y, max_x);
+    if (trace_path) trace_open(trace_path, max_y, max_x);
+
+    // Open FIFO for writing
+    fd = use_bus ? -1 : open("/tmp/my_drawing_pipe", O_WRONLY);
+    if (fd == -1 && !use_bus) {
+        endwin();
+        perror("ProducerA: open failed");
+        exit(1);
+    }
+    if (fd != -1) {
+        // First message: our screen size, for a headless ConsumerB
+        msg.x_coor = max_x;
+        msg.y_coor = max_y;
+        msg.command = 'S';
+        write(fd, &msg, sizeof(msg));
+    }
+
     x = max_x / 2;
     y = max_y / 2;
 
     mvprintw(0, 0, "Producer A: Use arrows to move. Press q to quit.");
+    // The starting point goes everywhere a move goes
     mvaddch(y, x, '*');
+    if (canvas) {
+        canvas_draw(canvas, y, x);
+    } else if (bus) {
+        bus_publish(bus, y, x);
+    } else {
+        msg.x_coor = x;
+        msg.y_coor = y;
+        msg.command = 'M';
+        write(fd, &msg, sizeof(msg));
+    }
+    if (trace_file) trace_add(y, x);
     refresh();
 
     while (1) {
@@ -45,10 +250,20 @@ int main()
 
         switch (ch) {
             case 'q':
-                msg.command = 'q';
-                write(fd, &msg, sizeof(msg));
                 endwin();
-                close(fd);
+                if (bus) {
+                    printf("Producer A: %lu moves published, %d viewers attached at exit\n",
+                           atomic_load(&bus->tail), atomic_load(&bus->viewers));
+                    bus_close(bus);
+                } else {
+                    msg.command = 'q';
+                    write(fd, &msg, sizeof(msg));
+                    close(fd);
+                }
+                if (trace_file) {
+                    if (fclose(trace_file) != 0) perror("ProducerA: trace");
+                    printf("Producer A: %ld moves recorded to %s\n", trace_points, trace_path);
+                }
                 printf("Producer A terminated.\n");
                 return 0;
 
@@ -60,11 +275,19 @@ int main()
                 continue;
         }
 
-        msg.x_coor = x;
-        msg.y_coor = y;
-        msg.command = 'M'; // move
+        if (canvas) {
+            canvas_draw(canvas, y, x);
+        } else if (bus) {
+            bus_publish(bus, y, x);
+            mvprintw(0, 49, " %d viewers  ", atomic_load(&bus->viewers));
+        } else {
+            msg.x_coor = x;
+            msg.y_coor = y;
+            msg.command = 'M'; // move
 
-        write(fd, &msg, sizeof(msg));
+            write(fd, &msg, sizeof(msg));
+        }
+        if (trace_file) trace_add(y, x);
 
         mvaddch(y, x, '*');
         refresh();
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <limits.h>
+
+struct DataCoord {
+    int x_coor;
+    int y_coor;
+    char command;
+};
+
+// Trace file, as written by ProducerA -r
+#define TRACE_MAGIC 0x52544344 // "DCTR"
+
+struct TraceHeader {
+    uint32_t magic;
+    uint16_t rows, cols;
+};
+
+struct TracePoint {
+    uint32_t dt_us;
+    uint16_t x, y;
+};
+
+// Latency board, same layout in ConsumerB.c. We note when each point
+// was written, ConsumerB takes the difference when it draws the point
+// and tells us when it has seen the 'q'. The FIFO holds far fewer
+// points than LAT_SLOTS, so a slot is never reused before it is read.
+#define LATENCY_NAME "/my_drawing_latency"
+#define LAT_SLOTS 65536
+
+struct Latency {
+    pid_t replayer;                 // Ours; a board left by a dead replay is ignored
+    int rows, cols;                 // Recorded on, for a headless ConsumerB
+    atomic_int done;                // ConsumerB got the 'q'
+    long received;                  // Points ConsumerB drew
+    uint64_t last_ns;               // When it got the 'q'
+    uint64_t sent_ns[LAT_SLOTS];    // Point n was written at sent_ns[n % LAT_SLOTS]
+};
+
+// Whole structs per write, and no more than PIPE_BUF so it is atomic:
+// every read of ConsumerB ends on a struct boundary
+#define REPLAY_BATCH (PIPE_BUF / sizeof(struct DataCoord))
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+    struct timespec ts = { ns / 1000000000ull, ns % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+static struct TraceHeader *trace_map(const char *path, long *count)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror("ReplayerR: cannot open trace");
+        exit(1);
+    }
+    if ((size_t)st.st_size < sizeof(struct TraceHeader)) {
+        fprintf(stderr, "ReplayerR: %s is not a trace\n", path);
+        exit(1);
+    }
+    struct TraceHeader *h = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED) {
+        perror("ReplayerR: mmap trace failed");
+        exit(1);
+    }
+    if (h->magic != TRACE_MAGIC) {
+        fprintf(stderr, "ReplayerR: %s is not a trace\n", path);
+        exit(1);
+    }
+    madvise(h, st.st_size, MADV_SEQUENTIAL);
+    *count = (st.st_size - sizeof(*h)) / sizeof(struct TracePoint);
+    return h;
+}
+
+static struct Latency *latency_create(int rows, int cols)
+{
+    shm_unlink(LATENCY_NAME);
+    int shm = shm_open(LATENCY_NAME, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (shm == -1 || ftruncate(shm, sizeof(struct Latency)) == -1) {
+        perror("ReplayerR: shm_open latency board failed");
+        exit(1);
+    }
+    struct Latency *l = mmap(NULL, sizeof(*l), PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    close(shm);
+    if (l == MAP_FAILED) {
+        perror("ReplayerR: mmap latency board failed");
+        exit(1);
+    }
+    l->replayer = getpid();
+    l->rows = rows;
+    l->cols = cols;
+    return l;
+}
+
+// Usage: ReplayerR trace [speed]
+// Feeds a trace recorded by ProducerA -r into the FIFO in place of
+// ProducerA. speed 1 (default) keeps the original timing, N plays it N
+// times faster, 0 sends it flat out. ConsumerB reports the latency.
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s trace [speed]\n", argv[0]);
+        exit(1);
+    }
+    double speed = argc > 2 ? atof(argv[2]) : 1.0;
+    long count;
+    struct TraceHeader *h = trace_map(argv[1], &count);
+    struct TracePoint *points = (struct TracePoint *)(h + 1);
+
+    // Ready before the FIFO opens, so ConsumerB finds it
+    struct Latency *lat = latency_create(h->rows, h->cols);
+
+    int fd = open("/tmp/my_drawing_pipe", O_WRONLY);
+    if (fd == -1) {
+        perror("ReplayerR: open failed");
+        exit(1);
+    }
+    if (speed > 0)
+        printf("Replayer R: %ld points recorded on %dx%d, at %gx speed\n", count, h->cols, h->rows, speed);
+    else
+        printf("Replayer R: %ld points recorded on %dx%d, flat out\n", count, h->cols, h->rows);
+
+    struct DataCoord batch[REPLAY_BATCH];
+    memset(batch, 0, sizeof(batch));
+    uint64_t start = now_ns(), due = start;
+    long writes = 0, late = 0;
+
+    for (long i = 0; i < count; ) {
+        int n = 0;
+        if (speed > 0) {
+            // Everything due by now goes in one write
+            uint64_t next = due + (uint64_t)(points[i].dt_us * 1000.0 / speed);
+            uint64_t t = now_ns();
+            if (next > t) sleep_until(next);
+            else if (t - next > 1000000) late++; // More than 1 ms behind
+            t = now_ns();
+            while (i + n < count && n < (int)REPLAY_BATCH && next <= t) {
+                due = next;
+                batch[n].x_coor = points[i + n].x;
+                batch[n].y_coor = points[i + n].y;
+                batch[n].command = 'M';
+                n++;
+                if (i + n < count) next = due + (uint64_t)(points[i + n].dt_us * 1000.0 / speed);
+            }
+        } else {
+            for (; i + n < count && n < (int)REPLAY_BATCH; n++) {
+                batch[n].x_coor = points[i + n].x;
+                batch[n].y_coor = points[i + n].y;
+                batch[n].command = 'M';
+            }
+        }
+
+        uint64_t t = now_ns();
+        for (int k = 0; k < n; k++) lat->sent_ns[(i + k) % LAT_SLOTS] = t;
+        if (write(fd, batch, n * sizeof(struct DataCoord)) != (ssize_t)(n * sizeof(struct DataCoord))) {
+            perror("ReplayerR: write failed");
+            exit(1);
+        }
+        writes++;
+        i += n;
+    }
+    uint64_t sent = now_ns();
+
+    struct DataCoord quit = { 0, 0, 'q' };
+    write(fd, &quit, sizeof(quit));
+    close(fd);
+
+    double elapsed = (sent - start) / 1e9;
+    printf("Replayer R: %ld points in %.3f s (%.0f points/s), %ld writes (%.1f points each)",
+           count, elapsed, elapsed > 0 ? count / elapsed : 0.0, writes, writes ? (double)count / writes : 0.0);
+    if (speed > 0) printf(", %ld more than 1 ms late", late);
+    printf("\n");
+
+    // End to end: until ConsumerB has drawn the last one
+    for (int tries = 0; tries < 10000 && !atomic_load(&lat->done); tries++) usleep(1000);
+    if (atomic_load(&lat->done)) {
+        double e2e = (lat->last_ns - start) / 1e9;
+        printf("Replayer R: ConsumerB drew %ld points in %.3f s (%.0f points/s)\n",
+               lat->received, e2e, e2e > 0 ? lat->received / e2e : 0.0);
+    } else {
+        printf("Replayer R: ConsumerB did not report back\n");
+    }
+    shm_unlink(LATENCY_NAME);
+    printf("Replayer R terminated.\n");
+    return 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+# select vs epoll vs io_uring: syscalls per message at full load,
+# and queueing delay percentiles at a fixed per-producer rate.
+# Usage: ./bench_backends.sh [producers] [messages per producer] [rate]
+
+P=${1:-100}
+N=${2:-5000}
+RATE=${3:-1000}
+
+for m in select epoll uring; do
+    echo "--- $m, flat out"
+    ./selectEX -m $m -p $P -n $N | grep -E "messages/s|syscalls"
+    echo "--- $m, $RATE writes/s per producer"
+    ./selectEX -m $m -p $P -n $((N / 10)) -r $RATE | grep "syscalls"
+done
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Flow control policies under overload: producers offer more than the
+# consumer can serve (-c), compare drops, credit stalls and delay.
+# Fails if any policy delivers a producer's messages out of order.
+# Usage: ./bench_flow.sh [producers] [messages per producer] [rate] [cost us]
+
+P=${1:-3}
+N=${2:-5000}
+RATE=${3:-30000}
+COST=${4:-20}
+status=0
+
+for f in none block drop-oldest drop-newest sample; do
+    echo "--- $f"
+    out=$(./selectEX -p $P -n $N -r $RATE -c $COST -s rr -f $f 2>&1)
+    echo "$out" | grep -E "messages/s|syscalls|Flow control|out of order"
+    # A sensor buffer smaller than the credit keeps it full
+    out+=$(./selectEX -p $P -n $N -c $COST -f $f -B 4 -q 8 2>&1)
+    if echo "$out" | grep -qE "[1-9][0-9]* (messages )?out of order"; then
+        echo "FAIL: $f delivered messages out of order"
+        status=1
+    fi
+done
+exit $status
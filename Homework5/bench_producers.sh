@@ -0,0 +1,12 @@
+#!/bin/bash
+# Consumer CPU per message as the number of producers grows.
+# The total message count stays the same for every run.
+# Usage: ./bench_producers.sh [total messages] [frames per producer write]
+
+TOTAL=${1:-1000000}
+B=${2:-1}
+
+for p in 2 10 100 500 1000; do
+    echo "--- $p producers"
+    ./selectEX -p $p -n $((TOTAL / p)) -b $B | grep "Consumer:"
+done
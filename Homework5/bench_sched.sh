@@ -0,0 +1,13 @@
+#!/bin/bash
+# Scheduling policies under overload: every producer sends flat out
+# and each message costs the consumer COST microseconds of CPU.
+# Usage: ./bench_sched.sh [messages per producer] [weights] [cost us]
+
+N=${1:-20000}
+W=${2:-1,2,4}
+COST=${3:-5}
+P=$(echo "$W" | tr ',' '\n' | wc -l)
+
+for s in random rr drr prio; do
+    ./selectEX -p $P -n $N -s $s -W $W -c $COST | grep -A $P "policy"
+done
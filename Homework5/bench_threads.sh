@@ -0,0 +1,16 @@
+#!/bin/bash
+# Processes + pipes vs threads + shared-memory rings (-T): throughput
+# flat out, and queueing delay at a fixed per-producer rate.
+# Build with -pthread. In -T runs the CPU figure includes the producers.
+# Usage: ./bench_threads.sh [producers] [messages per producer] [rate]
+
+P=${1:-4}
+N=${2:-200000}
+RATE=${3:-20000}
+
+for mode in "-m epoll" "-T"; do
+    echo "--- $mode, flat out"
+    ./selectEX $mode -p $P -n $N | grep -E "messages/s|syscalls|Threads"
+    echo "--- $mode, $RATE writes/s per producer"
+    ./selectEX $mode -p $P -n $((N / 10)) -r $RATE | grep -E "syscalls|CPU"
+done
@@ -0,0 +1,20 @@
+#!/bin/bash
+# Bulk payload throughput, copy path vs vmsplice/splice, 64 B .. 1 MiB.
+# About 256 MB per producer and run. /dev/null measures the transfer
+# alone; pass a file to include the sink's own cost.
+# Usage: ./bench_zerocopy.sh [producers] [sink]
+
+P=${1:-2}
+SINK=${2:-/dev/null}
+BYTES=$((256 * 1024 * 1024))
+
+for ((size = 64; size <= 1048576; size *= 4)); do
+    n=$((BYTES / size))
+    [ $n -gt 200000 ] && n=200000
+    for mode in copy splice; do
+        flag=""; [ $mode = splice ] && flag="-Z"
+        printf "%8d B %-6s " $size $mode
+        ./selectEX -p $P -z $size -n $n $flag -o "$SINK" | grep -E "MB/s|per GB" | tr '\n' ' '
+        echo
+    done
+done
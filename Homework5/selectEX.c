@@ -1,184 +1,1508 @@
+#define _GNU_SOURCE // splice(), vmsplice(), F_SETPIPE_SZ
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
 #include <sys/select.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <time.h>
 #include <errno.h>
 
 // Buffer size for messages
 #define BUF_SIZE 64
 
-// Function for Producer 1
-void producer1(int write_fd) {
-    char msg[BUF_SIZE];
-    int counter = 0;
-    
+// Wire format: every message is a header followed by len payload
+// bytes (no NUL). The consumer never has to guess where one message
+// ends, however many arrive in a single read().
+struct msg_header {
+    uint16_t len;       // Payload bytes, at most BUF_SIZE
+    uint16_t producer;  // Sender index, for sanity checks
+    uint32_t seq;       // Producer's message counter (wraps), must only go up
+    uint64_t sent_ns;   // CLOCK_MONOTONIC at the producer, for queueing delay
+};
+
+#define FRAME_MAX (sizeof(struct msg_header) + BUF_SIZE)
+
+// Per-producer reassembly buffer: one read() takes up to this much
+#define RX_SIZE 4096
+
+#define MAX_EVENTS 64
+
+// Messages served between two epoll_wait calls while work is queued
+#define SERVE_BATCH 64
+
+// Scheduling policies ("-s")
+#define POLICY_RANDOM 0  // Random non-empty queue (the original coin flip)
+#define POLICY_RR     1  // One message per non-empty queue in turn
+#define POLICY_DRR    2  // Deficit round robin: weight * DRR_QUANTUM bytes per turn
+#define POLICY_PRIO   3  // Highest weight first, always
+
+#define DRR_QUANTUM 128
+
+struct config {
+    int n_producers;
+    long n_msgs;    // Messages per producer; 0 = run forever at human speed
+    int burst;      // Frames a producer packs into one write()
+    int policy;
+    int queue_len;  // Messages buffered per producer inside the consumer
+    int cost_us;    // Simulated work per message, to overload the consumer
+    const char *weights; // "w1,w2,...", missing entries are 1
+    int bulk_size;  // Bulk mode: payload bytes per frame, 0 = text messages
+    int zero_copy;  // Bulk mode: vmsplice/splice instead of write/read
+    const char *sink; // Bulk mode: where the consumer forwards payloads
+    int backend;    // How the consumer waits for and reads the pipes
+    double rate;    // Writes/s per producer in -n runs, 0 = flat out
+    int flow;       // Credit-based flow control policy, FLOW_NONE = blind writes
+    int sensor_buf; // Flow control: messages a producer holds while out of credit
+};
+
+// Consumer backends ("-m")
+#define BACKEND_SELECT 0    // select() + read() per ready pipe
+#define BACKEND_EPOLL  1    // Edge-triggered epoll, drain until EAGAIN
+#define BACKEND_URING  2    // io_uring, a read kept posted on every pipe
+#define BACKEND_THREADS 3   // "-T": producer threads, shared-memory rings, no pipes
+
+// Flow control policies ("-f"), for a producer that is out of credit
+#define FLOW_NONE        0  // No credits: write() blocks on a full pipe (original)
+#define FLOW_BLOCK       1  // Wait for credit once the local buffer is full
+#define FLOW_DROP_OLDEST 2  // Full buffer: overwrite its oldest message
+#define FLOW_DROP_NEWEST 3  // Full buffer: discard the new message
+#define FLOW_SAMPLE      4  // Out of credit: keep 1 in SAMPLE_EVERY, drop-oldest
+
+#define SAMPLE_EVERY 8
+
+static struct config cfg = { 2, 0, 1, POLICY_RANDOM, 64, 0, NULL, 0, 0, "/dev/null", BACKEND_EPOLL, 0,
+                             FLOW_NONE, 16 };
+
+// Per-message printing only makes sense at human speed
+#define VERBOSE (cfg.n_msgs == 0)
+
+// A parsed message waiting for its turn
+struct queued_msg {
+    uint64_t sent_ns;
+    uint16_t len;
+    char data[BUF_SIZE];
+};
+
+// One per producer pipe
+struct source {
+    int fd;
+    int id;
+    char name[16];
+    char rx[RX_SIZE];   // Bytes read but not parsed yet (a partial frame)
+    int rx_len;
+    int readable;       // Edge seen, EAGAIN not reached yet
+    int eof;
+    int in_flight;      // io_uring: a read is posted
+    int uring_eof;      // io_uring: a read completed with 0
+    // Bounded queue; when full the pipe is left alone and the
+    // producer blocks on its write (backpressure)
+    struct queued_msg *queue;
+    int q_head, q_count;
+    int weight;
+    long deficit;       // DRR: bytes this queue may still send this turn
+    int in_active;
+    // Accounting
+    long received;
+    long served, served_bytes;
+    double delay_sum, delay_max;    // Seconds from send to service
+    uint32_t next_seq;              // Lowest seq the next frame may carry
+    // Bulk mode only
+    uint32_t bulk_hdr[2];   // {len, producer} of the current frame
+    int bulk_hdr_got;
+    uint32_t bulk_left;     // Payload bytes of the current frame still in the pipe
+};
+
+static long total_received = 0;
+static long total_reads = 0;    // read() calls that returned data
+static long total_bytes = 0;
+static long total_queued = 0;
+static long total_syscalls = 0; // Consumer: wait calls plus reads
+static long out_of_order = 0;   // Frames whose seq did not go up (duplicate or reordered)
+
+// Delay from send to service: log-linear histogram, 16 sub-buckets
+// per power of two (~6% resolution)
+#define HIST_SUB     16
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+static long delay_hist[HIST_BUCKETS];
+static long delay_count = 0;
+
+static int hist_index(uint64_t ns) {
+    if (ns < HIST_SUB) return ns;
+    int exp = 63 - __builtin_clzll(ns);
+    return (exp - 3) * HIST_SUB + ((ns >> (exp - 4)) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_value(int i) {
+    if (i < HIST_SUB) return i;
+    int exp = i / HIST_SUB + 3;
+    return (uint64_t)(HIST_SUB + i % HIST_SUB) << (exp - 4);
+}
+
+static double delay_percentile(double q) {
+    long target = q * delay_count, seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += delay_hist[i];
+        if (seen > target) return hist_value(i) / 1e3;
+    }
+    return 0;
+}
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Writes message number counter of producer id as a frame at out,
+// returns its size
+static int format_frame(char *out, int id, long counter, uint64_t t) {
+    struct msg_header *h = (struct msg_header *)out;
+    char *msg = (char *)(h + 1);
+    // Create a tagged message
+    int len;
+    if (id % 2 == 0) len = snprintf(msg, BUF_SIZE, "[P%d] Message %ld", id + 1, counter);
+    else len = snprintf(msg, BUF_SIZE, "<P%d> Data packet %ld", id + 1, counter);
+    if (len >= BUF_SIZE) len = BUF_SIZE - 1;
+    h->len = len;
+    h->producer = id;
+    h->seq = counter;
+    h->sent_ns = t;
+    return sizeof(*h) + len;
+}
+
+// Time between two writes of a producer. "-r": a fixed schedule of
+// interval_ns; -n without -r: none; human speed: a random sleep.
+static void producer_pause(int id, struct timespec *next, long interval_ns) {
+    if (!VERBOSE) {
+        if (interval_ns == 0) return; // Benchmark: as fast as the pipe allows
+        next->tv_nsec += interval_ns;
+        while (next->tv_nsec >= 1000000000L) {
+            next->tv_nsec -= 1000000000L;
+            next->tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL);
+        return;
+    }
+
+    // Sleep for a random interval
+    // usleep takes microseconds
+    int sleep_time = id % 2 == 0 ? 500000 + (rand() % 1000000)
+                                 : 200000 + (rand() % 600000);
+    usleep(sleep_time);
+}
+
+// Function for Producer i
+// Even producers behave like the original P1, odd ones like P2,
+// which sleeps less to create different cycles.
+void producer(int id, int write_fd) {
+    char *out = malloc(cfg.burst * FRAME_MAX);
+    long counter = 0;
+
     // Random seed based on PID
-    srand(getpid()); 
+    srand(getpid());
+
+    // "-r": one write every burst / rate seconds, on a fixed schedule
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long interval_ns = cfg.rate > 0 ? cfg.burst * 1e9 / cfg.rate : 0;
+
+    while (cfg.n_msgs == 0 || counter < cfg.n_msgs) {
+        // Pack up to cfg.burst frames back to back
+        int used = 0;
+        uint64_t t = now_ns();
+        for (int k = 0; k < cfg.burst && (cfg.n_msgs == 0 || counter < cfg.n_msgs); k++)
+            used += format_frame(out + used, id, counter++, t);
 
-    while (1) {
-        // Create a tagged message
-        snprintf(msg, BUF_SIZE, "[P1] Message %d", counter++);
-        
         // Write to pipe
-        if (write(write_fd, msg, strlen(msg) + 1) == -1) {
-            perror("P1 write error");
+        if (write(write_fd, out, used) == -1) {
+            perror("producer write error");
             exit(1);
         }
 
-        // Sleep for a random interval 
-        // usleep takes microseconds
-        int sleep_time = 500000 + (rand() % 1000000); 
-        usleep(sleep_time); 
+        producer_pause(id, &next, interval_ns);
+    }
+    free(out);
+}
+
+// ============================================================
+// CREDIT-BASED FLOW CONTROL ("-f policy")
+// The consumer grants every producer a budget of messages: one per
+// slot of its queue to start with, and one more each time it serves
+// a message of that producer. Credits live in shared memory, so a
+// producer sees its remaining credit (granted - sent) without a
+// syscall and never blocks inside write(). Messages produced while
+// out of credit wait in a small local buffer (-B, the sensor's own
+// memory); the policy says what happens when that is full. Only a
+// blocked producer sleeps, on a futex on its grant counter, and the
+// consumer only issues the wake-up when someone sleeps.
+// ============================================================
+struct credit {
+    atomic_uint granted;    // Messages allowed so far (wraps)
+    atomic_int waiting;     // Producer is asleep on granted
+    // Producer-side counters, read by the consumer after the run
+    long produced, sent, dropped;
+    long stalls;            // Times the producer ran out of credit
+    uint64_t stall_ns;      // Time spent out of credit with messages waiting
+} __attribute__((aligned(64)));
+
+static struct credit *credits = NULL;
+
+static const char *flow_name[] = { "none", "block", "drop-oldest", "drop-newest", "sample" };
+
+static void credit_setup(void) {
+    credits = mmap(NULL, cfg.n_producers * sizeof(struct credit), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (credits == MAP_FAILED) {
+        perror("credit mmap");
+        exit(1);
     }
+    for (int i = 0; i < cfg.n_producers; i++) atomic_store(&credits[i].granted, cfg.queue_len);
+}
+
+// Consumer: a slot of producer id's queue is free again
+static void credit_grant(int id) {
+    atomic_fetch_add(&credits[id].granted, 1);
+    if (atomic_load(&credits[id].waiting))
+        syscall(SYS_futex, &credits[id].granted, FUTEX_WAKE, 1, NULL, NULL, 0);
 }
 
-// Function for Producer 2
-void producer2(int write_fd) {
-    char msg[BUF_SIZE];
-    int counter = 0;
-    
+// Producer: sleep until there is credit
+static void credit_wait(struct credit *cr) {
+    atomic_store(&cr->waiting, 1);
+    unsigned g = atomic_load(&cr->granted);
+    if (g - (unsigned)cr->sent == 0)
+        syscall(SYS_futex, &cr->granted, FUTEX_WAIT, g, NULL, NULL, 0);
+    atomic_store(&cr->waiting, 0);
+}
+
+// Producer-local ring of frames waiting for credit
+struct flow_buf {
+    char (*frame)[FRAME_MAX];
+    int *len;
+    char *out;              // One write's worth, assembled
+    int cap, head, count;
+    int stalled;            // Out of credit with frames waiting
+    uint64_t stall_start;
+};
+
+// Sends as many buffered frames as the credit covers, in one write
+static void flow_send(struct credit *cr, struct flow_buf *b, int write_fd) {
+    unsigned credit = atomic_load(&cr->granted) - (unsigned)cr->sent;
+    if (credit == 0 && b->count > 0 && !b->stalled) {
+        b->stalled = 1;
+        b->stall_start = now_ns();
+        cr->stalls++;
+    }
+    if (credit > 0 && b->stalled) {
+        b->stalled = 0;
+        cr->stall_ns += now_ns() - b->stall_start;
+    }
+    int n = b->count < (int)credit ? b->count : (int)credit, used = 0;
+    for (int k = 0; k < n; k++) {
+        memcpy(b->out + used, b->frame[b->head], b->len[b->head]);
+        used += b->len[b->head];
+        b->head = (b->head + 1) % b->cap;
+    }
+    b->count -= n;
+    if (used > 0 && write(write_fd, b->out, used) == -1) {
+        perror("producer write error");
+        exit(1);
+    }
+    cr->sent += n;
+}
+
+void producer_flow(int id, int write_fd) {
+    struct credit *cr = &credits[id];
+    struct flow_buf b = { 0 };
+    b.cap = cfg.sensor_buf;
+    b.frame = malloc(b.cap * FRAME_MAX);
+    b.len = malloc(b.cap * sizeof(int));
+    b.out = malloc(b.cap * FRAME_MAX);
+    long skipped = 0;           // Sample policy: messages seen during this stall
+
     srand(getpid());
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long interval_ns = cfg.rate > 0 ? 1e9 / cfg.rate : 0;
+
+    while (cfg.n_msgs == 0 || cr->produced < cfg.n_msgs || b.count > 0) {
+        if (cfg.n_msgs == 0 || cr->produced < cfg.n_msgs) {
+            // A new message from the sensor
+            unsigned credit = atomic_load(&cr->granted) - (unsigned)cr->sent;
+            int admit = 1;
+            if (cfg.flow == FLOW_SAMPLE && credit <= (unsigned)b.count) admit = skipped++ % SAMPLE_EVERY == 0;
+            else skipped = 0;
+            if (admit && b.count == b.cap) {
+                if (cfg.flow == FLOW_BLOCK) {
+                    // Wait for credit and send, until a slot is free
+                    while (b.count == b.cap) {
+                        while (atomic_load(&cr->granted) - (unsigned)cr->sent == 0) credit_wait(cr);
+                        flow_send(cr, &b, write_fd);
+                    }
+                } else if (cfg.flow == FLOW_DROP_NEWEST) {
+                    admit = 0;
+                } else {
+                    b.head = (b.head + 1) % b.cap; // Drop-oldest (also for sample)
+                    b.count--;
+                    cr->dropped++;
+                }
+            }
+            if (admit) {
+                int slot = (b.head + b.count) % b.cap;
+                b.len[slot] = format_frame(b.frame[slot], id, cr->produced, now_ns());
+                b.count++;
+            } else {
+                cr->dropped++;
+            }
+            cr->produced++;
+        } else {
+            // Done producing: wait for the credit to flush what is left
+            if (atomic_load(&cr->granted) - (unsigned)cr->sent == 0) credit_wait(cr);
+        }
+
+        flow_send(cr, &b, write_fd);
+
+        if (cfg.n_msgs == 0 || cr->produced < cfg.n_msgs) producer_pause(id, &next, interval_ns);
+    }
+    free(b.frame);
+    free(b.len);
+    free(b.out);
+}
+
+static void print_flow(void) {
+    long produced = 0, sent = 0, dropped = 0, stalls = 0;
+    uint64_t stall_ns = 0;
+    for (int i = 0; i < cfg.n_producers; i++) {
+        produced += credits[i].produced;
+        sent += credits[i].sent;
+        dropped += credits[i].dropped;
+        stalls += credits[i].stalls;
+        stall_ns += credits[i].stall_ns;
+    }
+    printf("Flow control %s (credit %d, sensor buffer %d): %ld produced, %ld sent, "
+           "%ld dropped (%.2f%%), %ld credit stalls, %.3f s stalled, %ld out of order\n",
+           flow_name[cfg.flow], cfg.queue_len, cfg.sensor_buf, produced, sent, dropped,
+           produced ? 100.0 * dropped / produced : 0.0, stalls, stall_ns / 1e9, out_of_order);
+    if (cfg.n_producers > 16) return;
+    for (int i = 0; i < cfg.n_producers; i++)
+        printf("  P%d: %ld produced, %ld dropped, %ld stalls, %.3f s stalled\n", i + 1,
+               credits[i].produced, credits[i].dropped, credits[i].stalls, credits[i].stall_ns / 1e9);
+}
+
+// ============================================================
+// SCHEDULER
+// Pipes are drained into per-producer queues; the policy decides
+// which queue the consumer serves next. Non-empty queues sit in the
+// active ring, so a turn never scans idle producers.
+// ============================================================
+static struct source **active = NULL;   // Ring of non-empty queues
+static int act_head = 0, act_count = 0;
+
+// While every producer is still sending, shares mean something;
+// they are frozen when the first one finishes
+static int contended = 1;
+static long *share_msgs = NULL, *share_bytes = NULL;
+
+static void active_push(struct source *src) {
+    active[(act_head + act_count) % cfg.n_producers] = src;
+    act_count++;
+    src->in_active = 1;
+}
 
+static struct source *active_pop(void) {
+    struct source *src = active[act_head];
+    act_head = (act_head + 1) % cfg.n_producers;
+    act_count--;
+    src->in_active = 0;
+    return src;
+}
+
+static void enqueue(struct source *src, const struct msg_header *h, const char *payload) {
+    // Drops leave gaps, but a frame may never come twice or go back
+    if ((int32_t)(h->seq - src->next_seq) < 0) {
+        if (out_of_order++ < 5)
+            fprintf(stderr, "Consumer: %s sent %u after %u\n", src->name, h->seq, src->next_seq - 1);
+    }
+    src->next_seq = h->seq + 1;
+    struct queued_msg *m = &src->queue[(src->q_head + src->q_count) % cfg.queue_len];
+    m->sent_ns = h->sent_ns;
+    m->len = h->len;
+    memcpy(m->data, payload, h->len);
+    src->q_count++;
+    total_queued++;
+    if (!src->in_active) active_push(src);
+}
+
+// The consumer's actual work on one message
+static void serve(struct source *src) {
+    struct queued_msg *m = &src->queue[src->q_head];
+    uint64_t delay_ns = now_ns() - m->sent_ns;
+    double delay = delay_ns / 1e9;
+
+    if (VERBOSE) printf("Consumer received from %s: %.*s\n", src->name, m->len, m->data);
+    if (cfg.cost_us > 0) {
+        uint64_t until = now_ns() + cfg.cost_us * 1000ull;
+        while (now_ns() < until); // Busy: CPU time is what is being shared
+    }
+
+    src->served++;
+    src->served_bytes += m->len;
+    src->delay_sum += delay;
+    delay_hist[hist_index(delay_ns)]++;
+    delay_count++;
+    if (delay > src->delay_max) src->delay_max = delay;
+    if (contended) {
+        share_msgs[src->id]++;
+        share_bytes[src->id] += m->len;
+    }
+
+    src->q_head = (src->q_head + 1) % cfg.queue_len;
+    src->q_count--;
+    total_queued--;
+    if (credits) credit_grant(src->id);
+}
+
+static int ingest(struct source *src);
+
+// One scheduling decision; returns the messages served
+static int schedule(void) {
+    struct source *src;
+    int n = 0;
+
+    switch (cfg.policy) {
+    case POLICY_RANDOM: {
+        // Swap a random queue to the front, serve one message
+        int k = (act_head + rand() % act_count) % cfg.n_producers;
+        src = active[k];
+        active[k] = active[act_head];
+        active[act_head] = src;
+        active_pop();
+        serve(src);
+        n = 1;
+        break;
+    }
+    case POLICY_RR:
+        src = active_pop();
+        serve(src);
+        n = 1;
+        break;
+    case POLICY_DRR:
+        // Each turn adds weight * quantum bytes of credit; messages
+        // go while the head fits. An emptied queue loses its credit.
+        src = active_pop();
+        src->deficit += (long)src->weight * DRR_QUANTUM;
+        while (src->q_count > 0 && src->queue[src->q_head].len <= src->deficit) {
+            src->deficit -= src->queue[src->q_head].len;
+            serve(src);
+            n++;
+        }
+        if (src->q_count == 0) src->deficit = 0;
+        break;
+    default: { // POLICY_PRIO
+        int best = act_head;
+        for (int k = 1; k < act_count; k++) {
+            int i = (act_head + k) % cfg.n_producers;
+            struct source *s = active[i];
+            if (s->weight > active[best]->weight ||
+                (s->weight == active[best]->weight && s->id < active[best]->id)) best = i;
+        }
+        src = active[best];
+        active[best] = active[act_head];
+        active[act_head] = src;
+        active_pop();
+        serve(src);
+        n = 1;
+        break;
+    }
+    }
+
+    // Room again: take in what the pipe still holds
+    ingest(src);
+    if (src->q_count > 0 && !src->in_active) active_push(src);
+    return n;
+}
+
+// Parses complete frames from src->rx into the queue until it is full,
+// and keeps the rest at the front. Returns -1 on a corrupt stream.
+static int parse_frames(struct source *src) {
+    int off = 0;
+    while (src->q_count < cfg.queue_len && src->rx_len - off >= (int)sizeof(struct msg_header)) {
+        struct msg_header h;
+        memcpy(&h, src->rx + off, sizeof(h));
+        if (h.len > BUF_SIZE || h.producer != src->id) {
+            fprintf(stderr, "Consumer: corrupt frame from %s\n", src->name);
+            return -1;
+        }
+        if (src->rx_len - off < (int)(sizeof(h) + h.len)) break; // Rest not here yet
+        src->received++;
+        total_received++;
+        enqueue(src, &h, src->rx + off + sizeof(h));
+        off += sizeof(h) + h.len;
+    }
+    memmove(src->rx, src->rx + off, src->rx_len - off);
+    src->rx_len -= off;
+    return 0;
+}
+
+// Helper to drain a ready pipe
+// The fd is edge-triggered, so we read until EAGAIN, unless the
+// producer's queue fills first: then the edge is remembered in
+// src->readable and reading resumes when the scheduler makes room.
+// Each read() may carry many frames; all that fit are parsed at once.
+int read_from_pipe(struct source *src) {
     while (1) {
-        snprintf(msg, BUF_SIZE, "<P2> Data packet %d", counter++);
-        
-        if (write(write_fd, msg, strlen(msg) + 1) == -1) {
-            perror("P2 write error");
-            exit(1);
+        if (parse_frames(src) == -1) return -1;
+        if (src->q_count == cfg.queue_len) return 1; // Full: backpressure
+        if (!src->readable) return 1;
+
+        int nbytes = read(src->fd, src->rx + src->rx_len, RX_SIZE - src->rx_len);
+        total_syscalls++;
+
+        if (nbytes > 0) {
+            total_reads++;
+            total_bytes += nbytes;
+            src->rx_len += nbytes;
+        } else if (nbytes == 0) {
+            if (src->rx_len > 0) fprintf(stderr, "Consumer: %s ended in a partial frame\n", src->name);
+            if (VERBOSE) printf("Consumer: %s closed connection.\n", src->name);
+            return 0;
+        } else if (errno == EAGAIN) {
+            src->readable = 0; // Drained
+            return 1;
+        } else if (errno != EINTR) {
+            perror("read error");
+            return -1;
         }
+    }
+}
+
+static int active_producers = 0;
+static int uring_ingest(struct source *src);
+static int spsc_ingest(struct source *src);
 
-        // P2 sleeps faster to create different cycles
-        int sleep_time = 200000 + (rand() % 600000);
-        usleep(sleep_time);
+// read_from_pipe (or its io_uring / ring form) plus end-of-stream handling
+static int ingest(struct source *src) {
+    if (src->eof) return 0;
+    int r = cfg.backend == BACKEND_URING   ? uring_ingest(src)
+          : cfg.backend == BACKEND_THREADS ? spsc_ingest(src)
+          : read_from_pipe(src);
+    if (r <= 0) {
+        if (src->fd != -1) close(src->fd); // Also removes it from the epoll set
+        src->eof = 1;
+        src->readable = 0;
+        active_producers--;
+        contended = 0;
     }
+    return r;
 }
 
-// Helper to read from a ready pipe
-int read_from_pipe(int fd, const char* source_name) {
-    char buffer[BUF_SIZE];
-    int nbytes = read(fd, buffer, BUF_SIZE);
-    
-    if (nbytes > 0) {
-        printf("Consumer received from %s: %s\n", source_name, buffer);
-        return 1; 
-    } else if (nbytes == 0) {
-        printf("Consumer: %s closed connection.\n", source_name);
-        return 0; 
-    } else {
-        perror("read error");
-        return -1; 
+// ============================================================
+// CONSUMER BACKENDS
+// backend_wait(timeout) waits for pipe data, hands every ready
+// source to ingest() and returns how many there were (-1 = error).
+// The scheduler and the queues do not know which backend runs.
+// ============================================================
+static struct source *all_sources = NULL;
+static int ep_fd = -1;
+
+// --- SELECT (the original loop, N pipes) ---
+// Level-triggered; pipes whose queue is full are left out of the set.
+static int select_wait(int timeout_ms) {
+    fd_set read_fds;
+    int max_fd = -1;
+    FD_ZERO(&read_fds);
+    for (int i = 0; i < cfg.n_producers; i++) {
+        struct source *src = &all_sources[i];
+        if (src->eof || src->q_count == cfg.queue_len) continue;
+        FD_SET(src->fd, &read_fds);
+        if (src->fd > max_fd) max_fd = src->fd;
+    }
+
+    struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    int activity = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
+    total_syscalls++;
+    if (activity < 0) {
+        if (errno == EINTR) return 0;
+        perror("select error");
+        return -1;
+    }
+
+    for (int i = 0; i < cfg.n_producers && activity > 0; i++) {
+        struct source *src = &all_sources[i];
+        if (src->eof || !FD_ISSET(src->fd, &read_fds)) continue;
+        src->readable = 1;
+        ingest(src);
+    }
+    return activity;
+}
+
+// --- EPOLL ---
+static int epoll_backend_wait(int timeout_ms) {
+    struct epoll_event events[MAX_EVENTS];
+    int activity = epoll_wait(ep_fd, events, MAX_EVENTS, timeout_ms);
+    total_syscalls++;
+    if (activity < 0) {
+        if (errno == EINTR) return 0;
+        perror("epoll_wait error");
+        return -1;
+    }
+
+    for (int k = 0; k < activity; k++) {
+        struct source *src = events[k].data.ptr;
+        src->readable = 1;
+        ingest(src);
     }
+    return activity;
 }
 
-int main() {
-    int pipe1[2], pipe2[2];
-    pid_t pid1, pid2;
+// --- IO_URING (raw syscalls, no liburing) ---
+// One READ_FIXED stays posted on every pipe, straight into the
+// producer's reassembly buffer. The buffers and the pipe fds are
+// registered with the ring up front. One io_uring_enter submits the
+// re-posted reads and waits; completions are then reaped from the
+// shared CQ ring in a batch, without any per-pipe syscall. When
+// work is queued and nothing needs submitting, reaping costs no
+// syscall at all. Pipes stay blocking: on an O_NONBLOCK fd io_uring
+// would complete the read with -EAGAIN instead of waiting for data.
+struct uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+    int fixed_bufs;     // Buffers registered: READ_FIXED, else READ
+};
+
+static struct uring ring;
+
+static void uring_setup(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    unsigned entries = 1;
+    while (entries < (unsigned)cfg.n_producers) entries <<= 1;
 
-    // 1. Create Pipes
-    if (pipe(pipe1) == -1 || pipe(pipe2) == -1) {
-        perror("pipe creation failed");
+    ring.fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring.fd == -1) {
+        perror("io_uring_setup");
+        exit(1);
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        fprintf(stderr, "io_uring: kernel too old (needs 5.11 or later)\n");
         exit(1);
     }
 
-    // 2. Fork Producer 1
-    pid1 = fork();
-    if (pid1 == 0) {
-        // Child P1
-        close(pipe1[0]); // Close read end
-        close(pipe2[0]); // Close P2's pipe completely
-        close(pipe2[1]);
-        producer1(pipe1[1]);
-        exit(0);
-    }
-
-    // 3. Fork Producer 2
-    pid2 = fork();
-    if (pid2 == 0) {
-        // Child P2
-        close(pipe2[0]); // Close read end
-        close(pipe1[0]); // Close P1's pipe completely
-        close(pipe1[1]);
-        producer2(pipe2[1]);
-        exit(0);
-    }
-
-    // 4. Consumer (Parent Process) Logic
-    close(pipe1[1]); // Close write ends
-    close(pipe2[1]);
-
-    int fd1 = pipe1[0];
-    int fd2 = pipe2[0];
-    int max_fd = (fd1 > fd2 ? fd1 : fd2) + 1;
-    
-    fd_set read_fds;
-    struct timeval timeout;
-    
-    // Seed random for the fair choice logic
-    srand(time(NULL)); 
+    // SQ and CQ rings share one mapping; the SQEs have their own
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    char *rings = mmap(NULL, sq_size > cq_size ? sq_size : cq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (rings == MAP_FAILED || ring.sqes == MAP_FAILED) {
+        perror("io_uring mmap");
+        exit(1);
+    }
+    ring.sq_head = (unsigned *)(rings + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(rings + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(rings + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(rings + p.sq_off.array);
+    ring.cq_head = (unsigned *)(rings + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(rings + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(rings + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(rings + p.cq_off.cqes);
+    ring.sq_local_tail = *ring.sq_tail;
 
-    printf("Consumer started. Monitoring FD %d (P1) and FD %d (P2)...\n", fd1, fd2);
+    int *fds = malloc(cfg.n_producers * sizeof(int));
+    struct iovec *bufs = malloc(cfg.n_producers * sizeof(struct iovec));
+    for (int i = 0; i < cfg.n_producers; i++) {
+        fds[i] = all_sources[i].fd;
+        bufs[i].iov_base = all_sources[i].rx;
+        bufs[i].iov_len = RX_SIZE;
+    }
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_FILES, fds, cfg.n_producers) == -1) {
+        perror("io_uring register files");
+        exit(1);
+    }
+    ring.fixed_bufs = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS,
+                              bufs, cfg.n_producers) == 0;
+    if (!ring.fixed_bufs) perror("io_uring register buffers (falling back to plain reads)");
+    free(fds);
+    free(bufs);
+}
 
-    int active_producers = 2;
+static void uring_post_read(struct source *src) {
+    unsigned idx = ring.sq_local_tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = ring.fixed_bufs ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = src->id;          // Index in the registered file table
+    sqe->off = (uint64_t)-1;    // Pipes have no offset
+    sqe->addr = (uint64_t)(uintptr_t)(src->rx + src->rx_len);
+    sqe->len = RX_SIZE - src->rx_len;
+    sqe->buf_index = src->id;
+    sqe->user_data = src->id;
+    ring.sq_array[idx] = idx;
+    ring.sq_local_tail++;
+    __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+    ring.to_submit++;
+    src->in_flight = 1;
+}
 
-    while (active_producers > 0) {
-        FD_ZERO(&read_fds);
-        FD_SET(fd1, &read_fds);
-        FD_SET(fd2, &read_fds);
+// Parses what the last read brought and re-posts a read if the
+// queue has room (a full queue leaves the pipe alone: backpressure)
+static int uring_ingest(struct source *src) {
+    if (parse_frames(src) == -1) return -1;
+    if (src->in_flight) return 1;
+    if (src->uring_eof) {
+        if (src->rx_len > 0) fprintf(stderr, "Consumer: %s ended in a partial frame\n", src->name);
+        if (VERBOSE) printf("Consumer: %s closed connection.\n", src->name);
+        return 0;
+    }
+    if (src->q_count < cfg.queue_len) uring_post_read(src);
+    return 1;
+}
 
-        // Set a timeout
-        // If no data arrives in 2s, do something else
-        timeout.tv_sec = 2;
-        timeout.tv_usec = 0;
+static int uring_wait(int timeout_ms) {
+    unsigned head = *ring.cq_head;
+    int ready = head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
 
-        // --- THE SELECT CALL ---
-        int activity = select(max_fd, &read_fds, NULL, NULL, &timeout);
+    // Enter the kernel only to submit, or to sleep when nothing is there
+    if (ring.to_submit > 0 || (!ready && timeout_ms > 0)) {
+        struct __kernel_timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+        struct io_uring_getevents_arg arg = { 0, 0, 0, (uint64_t)(uintptr_t)&ts };
+        unsigned wait_nr = !ready && timeout_ms > 0 ? 1 : 0;
+        int r = syscall(__NR_io_uring_enter, ring.fd, ring.to_submit, wait_nr,
+                        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        total_syscalls++;
+        if (r == -1 && errno != ETIME && errno != EINTR) {
+            perror("io_uring_enter");
+            return -1;
+        }
+        ring.to_submit = ring.sq_local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    }
 
-        if ((activity < 0) && (errno != EINTR)) {
-            perror("select error");
-            break;
+    // Reap every completion in one pass
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    int activity = 0;
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        struct source *src = &all_sources[cqe->user_data];
+        int res = cqe->res;
+        src->in_flight = 0;
+        if (res > 0) {
+            total_reads++;
+            total_bytes += res;
+            src->rx_len += res;
+        } else if (res == 0) {
+            src->uring_eof = 1;
+        } else if (res != -EINTR && res != -EAGAIN) {
+            errno = -res;
+            perror("io_uring read");
+            src->uring_eof = 1;
         }
+        ingest(src);
+        activity++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    return activity;
+}
 
-        if (activity == 0) {
-            printf("Consumer: Idle... waiting for data.\n");
+// --- THREADS ("-T") ---
+// Producers are threads of the consumer process. Each one owns a
+// single-producer single-consumer ring of whole frames in shared
+// memory: no pipe, no copy through the kernel, no context switch
+// while both sides are busy. The producer's and the consumer's
+// indexes live on separate cache lines, and each side keeps a
+// private copy of the other's index, so the shared lines are only
+// touched when the cached view says the ring is full (or empty).
+//
+// Waiting is spin-then-park: a side that finds nothing to do polls
+// for SPIN_POLLS rounds, then sleeps on a futex. It announces that
+// in a parked flag first and checks once more, and the other side
+// only makes the futex syscall when it sees the flag, so a busy
+// pipeline runs without any syscall at all.
+#define SPSC_SLOTS 256      // Frames per ring, a power of two
+#define SPIN_POLLS 4000     // Empty polls before a thread parks
+
+// Spinning only pays when the other side runs on another CPU
+static int spin_polls = SPIN_POLLS;
+
+struct spsc_slot {
+    struct msg_header h;
+    char data[BUF_SIZE];
+};
+
+struct spsc_ring {
+    // Producer's line
+    _Alignas(64) atomic_uint tail;      // Next slot to fill
+    atomic_int closed;                  // Producer finished, after its last tail
+    unsigned head_cache;                // Producer's view of head
+    // Consumer's line
+    _Alignas(64) atomic_uint head;      // Next slot to read; the producer parks on it
+    atomic_int producer_parked;
+    unsigned tail_cache;                // Consumer's view of tail
+    // Producer-side counters, read after the join
+    _Alignas(64) long spins, parks;
+    struct spsc_slot slot[SPSC_SLOTS];
+};
+
+static struct spsc_ring *rings = NULL;
+static pthread_t *producer_threads = NULL;
+
+// The consumer parks on consumer_seq; producers bump it to wake it
+static _Alignas(64) atomic_uint consumer_seq;
+static atomic_int consumer_parked;
+static long consumer_parks = 0, futex_wakes = 0;
+static atomic_long producer_wakes;
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+static void spsc_setup(void) {
+    rings = mmap(NULL, cfg.n_producers * sizeof(struct spsc_ring), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    producer_threads = calloc(cfg.n_producers, sizeof(pthread_t));
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) spin_polls = 0;
+    if (rings == MAP_FAILED || !producer_threads) {
+        perror("ring allocation");
+        exit(1);
+    }
+}
+
+// Producer: wait until the ring has room for one more frame
+static void spsc_wait_room(struct spsc_ring *r, unsigned tail) {
+    for (int spins = 0; tail - r->head_cache == SPSC_SLOTS; spins++) {
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail - r->head_cache < SPSC_SLOTS) break;
+        if (spins < spin_polls) {
+            r->spins++;
+            cpu_relax();
             continue;
         }
+        atomic_store(&r->producer_parked, 1);
+        unsigned head = atomic_load(&r->head);
+        if (tail - head == SPSC_SLOTS) {
+            r->parks++;
+            syscall(SYS_futex, &r->head, FUTEX_WAIT_PRIVATE, head, NULL, NULL, 0);
+        }
+        atomic_store(&r->producer_parked, 0);
+        spins = 0;
+    }
+}
 
-        // Check which FDs are ready
-        int p1_ready = FD_ISSET(fd1, &read_fds);
-        int p2_ready = FD_ISSET(fd2, &read_fds);
+// Producer: make frames up to tail visible, wake the consumer if it sleeps
+static void spsc_publish(struct spsc_ring *r, unsigned tail) {
+    atomic_store(&r->tail, tail);   // seq_cst: ordered before the parked check
+    if (atomic_load(&consumer_parked) && atomic_exchange(&consumer_parked, 0)) {
+        atomic_fetch_add(&consumer_seq, 1);
+        syscall(SYS_futex, &consumer_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        atomic_fetch_add(&producer_wakes, 1);
+    }
+}
 
-        // --- NON-DETERMINISM / FAIRNESS LOGIC ---
-        // If both are ready, randomly decide which one to read first
-        if (p1_ready && p2_ready) {
-            if (rand() % 2 == 0) {
-                // Read P1 then P2
-                if (read_from_pipe(fd1, "Pipe 1") == 0) active_producers--;
-                if (read_from_pipe(fd2, "Pipe 2") == 0) active_producers--;
-            } else {
-                // Read P2 then P1
-                if (read_from_pipe(fd2, "Pipe 2") == 0) active_producers--;
-                if (read_from_pipe(fd1, "Pipe 1") == 0) active_producers--;
+// Same messages and pacing as producer(), into the ring; a burst
+// (-b) is published with a single tail update
+static void *producer_thread(void *arg) {
+    int id = (int)(intptr_t)arg;
+    struct spsc_ring *r = &rings[id];
+    unsigned tail = atomic_load(&r->tail);
+    long counter = 0;
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long interval_ns = cfg.rate > 0 ? cfg.burst * 1e9 / cfg.rate : 0;
+
+    while (cfg.n_msgs == 0 || counter < cfg.n_msgs) {
+        uint64_t t = now_ns();
+        for (int k = 0; k < cfg.burst && (cfg.n_msgs == 0 || counter < cfg.n_msgs); k++) {
+            spsc_wait_room(r, tail);
+            format_frame((char *)&r->slot[tail % SPSC_SLOTS], id, counter++, t);
+            tail++;
+        }
+        spsc_publish(r, tail);
+        producer_pause(id, &next, interval_ns);
+    }
+    atomic_store(&r->closed, 1);
+    spsc_publish(r, tail);
+    return NULL;
+}
+
+// Consumer: moves frames from the ring into the queue until it is
+// full, then frees their slots with one head update
+static int spsc_ingest(struct source *src) {
+    struct spsc_ring *r = &rings[src->id];
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed), start = head;
+    int closed = atomic_load_explicit(&r->closed, memory_order_acquire);
+    if (head == r->tail_cache) r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    while (src->q_count < cfg.queue_len && head != r->tail_cache) {
+        struct spsc_slot *s = &r->slot[head % SPSC_SLOTS];
+        if (s->h.len > BUF_SIZE || s->h.producer != src->id) {
+            fprintf(stderr, "Consumer: corrupt frame from %s\n", src->name);
+            return -1;
+        }
+        src->received++;
+        total_received++;
+        total_bytes += sizeof(s->h) + s->h.len;
+        enqueue(src, &s->h, s->data);
+        head++;
+        if (head == r->tail_cache) r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    }
+    if (head == start) return closed && head == r->tail_cache ? 0 : 1;
+
+    total_reads++;
+    atomic_store(&r->head, head);   // seq_cst: ordered before the parked check
+    // A parked producer found the ring full; wake it once half is free,
+    // so it gets a batch of room per wake-up instead of one slot
+    if (atomic_load(&r->producer_parked) && atomic_load(&r->tail) - head <= SPSC_SLOTS / 2 &&
+        atomic_exchange(&r->producer_parked, 0)) {
+        syscall(SYS_futex, &r->head, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        total_syscalls++;
+        futex_wakes++;
+    }
+    if (VERBOSE && closed && head == r->tail_cache) printf("Consumer: %s finished.\n", src->name);
+    return 1;
+}
+
+static int spsc_ready(struct source *src) {
+    struct spsc_ring *r = &rings[src->id];
+    return atomic_load_explicit(&r->tail, memory_order_acquire) != atomic_load_explicit(&r->head, memory_order_relaxed)
+        || atomic_load_explicit(&r->closed, memory_order_acquire);
+}
+
+static int spsc_poll(void) {
+    int activity = 0;
+    for (int i = 0; i < cfg.n_producers; i++) {
+        struct source *src = &all_sources[i];
+        if (src->eof || src->q_count == cfg.queue_len || !spsc_ready(src)) continue;
+        ingest(src);
+        activity++;
+    }
+    return activity;
+}
+
+static int spsc_wait(int timeout_ms) {
+    int activity = spsc_poll();
+    if (activity > 0 || timeout_ms == 0) return activity;
+
+    for (int spins = 0; spins < spin_polls; spins++) {
+        cpu_relax();
+        if ((activity = spsc_poll()) > 0) return activity;
+    }
+
+    // Park. A producer that publishes after the flag is set sees it;
+    // one that published before is caught by the last poll.
+    atomic_store(&consumer_parked, 1);
+    unsigned seq = atomic_load(&consumer_seq);
+    if ((activity = spsc_poll()) == 0) {
+        struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+        syscall(SYS_futex, &consumer_seq, FUTEX_WAIT_PRIVATE, seq, &ts, NULL, 0);
+        total_syscalls++;
+        consumer_parks++;
+    }
+    atomic_store(&consumer_parked, 0);
+    return activity > 0 ? activity : spsc_poll();
+}
+
+static int backend_wait(int timeout_ms) {
+    switch (cfg.backend) {
+    case BACKEND_SELECT:  return select_wait(timeout_ms);
+    case BACKEND_URING:   return uring_wait(timeout_ms);
+    case BACKEND_THREADS: return spsc_wait(timeout_ms);
+    default:              return epoll_backend_wait(timeout_ms);
+    }
+}
+
+static const char *backend_name[] = { "select", "epoll", "io_uring", "threads" };
+
+// Hundreds of producers need more descriptors than the default soft limit
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static double cpu_seconds(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+         + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *policy_name[] = { "random", "rr", "drr", "prio" };
+
+// Throughput share while all producers competed, and queueing delay
+static void print_fairness(struct source *sources) {
+    long msgs = 0, bytes = 0, weights = 0;
+    for (int i = 0; i < cfg.n_producers; i++) {
+        msgs += share_msgs[i];
+        bytes += share_bytes[i];
+        weights += sources[i].weight;
+    }
+    if (msgs == 0) return;
+
+    // Jain's index over share / weight: 1.0 = exactly as weighted
+    double sum = 0, sum_sq = 0;
+    for (int i = 0; i < cfg.n_producers; i++) {
+        double x = (double)share_bytes[i] / bytes / ((double)sources[i].weight / weights);
+        sum += x;
+        sum_sq += x * x;
+    }
+    printf("Consumer: %s policy, %ld messages served while all producers competed, "
+           "weighted fairness (Jain) %.3f\n",
+           policy_name[cfg.policy], msgs, sum * sum / (cfg.n_producers * sum_sq));
+
+    if (cfg.n_producers > 16) return;
+    for (int i = 0; i < cfg.n_producers; i++) {
+        struct source *s = &sources[i];
+        printf("  %s weight %d: %5.1f%% of messages, %5.1f%% of bytes; delay mean %.3f ms, max %.3f ms\n",
+               s->name, s->weight, 100.0 * share_msgs[i] / msgs, 100.0 * share_bytes[i] / bytes,
+               s->served ? s->delay_sum / s->served * 1e3 : 0.0, s->delay_max * 1e3);
+    }
+}
+
+// ============================================================
+// BULK PAYLOAD MODE ("-z size")
+// For large sensor frames. Each frame is a {len, producer} header
+// plus len payload bytes, and the consumer does not look at the
+// payload: it forwards it to the sink (-o). The copy path is
+// writev -> pipe -> read -> user buffer -> write. With -Z the
+// producer maps its pages into the pipe with vmsplice and the
+// consumer moves them to the sink with splice, so the payload never
+// passes through the consumer's memory. vmsplice without
+// SPLICE_F_GIFT references the producer's pages, so the producer
+// must not change a payload until it has been consumed; the
+// benchmark payload is constant, which makes that trivially true.
+// ============================================================
+#define BULK_PIPE_SIZE (1 << 20)    // Pipe capacity asked for (the default unprivileged max)
+#define BULK_CHUNK     (1 << 16)    // Copy path: bytes per read()
+
+static long bulk_frames = 0;
+static long bulk_bytes = 0;
+static long bulk_calls = 0;         // read/splice calls that moved payload
+
+// Pushes the whole iovec into the pipe, with writev or vmsplice
+static void bulk_send(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = cfg.zero_copy ? vmsplice(fd, iov, cnt, 0) : writev(fd, iov, cnt);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror(cfg.zero_copy ? "producer vmsplice error" : "producer writev error");
+            exit(1);
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void producer_bulk(int id, int write_fd) {
+    // Own mappings, not malloc: free() would write allocator metadata
+    // into pages the pipe may still reference. munmap is safe, the
+    // pipe keeps its own reference to the pages.
+    long page = sysconf(_SC_PAGESIZE);
+    uint32_t *hdr = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char *payload = mmap(NULL, cfg.bulk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (hdr == MAP_FAILED || payload == MAP_FAILED) {
+        perror("producer mmap");
+        exit(1);
+    }
+    hdr[0] = cfg.bulk_size;
+    hdr[1] = id;
+    for (int i = 0; i < cfg.bulk_size; i++) payload[i] = 'A' + (id + i) % 26;
+
+    for (long n = 0; n < cfg.n_msgs; n++) {
+        struct iovec iov[2] = {
+            { hdr, 2 * sizeof(uint32_t) },
+            { payload, cfg.bulk_size }
+        };
+        bulk_send(write_fd, iov, 2);
+    }
+    munmap(hdr, page);
+    munmap(payload, cfg.bulk_size);
+}
+
+// Drains a ready pipe into the sink. Returns 0 at EOF, -1 on error.
+static int bulk_forward(struct source *src, int sink_fd, char *buf) {
+    while (1) {
+        if (src->bulk_left == 0) {
+            // Header: the only bytes the consumer really reads
+            int n = read(src->fd, (char *)src->bulk_hdr + src->bulk_hdr_got,
+                         sizeof(src->bulk_hdr) - src->bulk_hdr_got);
+            if (n == 0) return 0;
+            if (n == -1) {
+                if (errno == EAGAIN) return 1;
+                if (errno == EINTR) continue;
+                perror("read error");
+                return -1;
+            }
+            src->bulk_hdr_got += n;
+            if (src->bulk_hdr_got < (int)sizeof(src->bulk_hdr)) continue;
+            src->bulk_hdr_got = 0;
+            if (src->bulk_hdr[1] != (uint32_t)src->id) {
+                fprintf(stderr, "Consumer: corrupt frame from %s\n", src->name);
+                return -1;
+            }
+            src->bulk_left = src->bulk_hdr[0];
+            bulk_frames++;
+            continue;
+        }
+
+        ssize_t n;
+        if (cfg.zero_copy) {
+            n = splice(src->fd, NULL, sink_fd, NULL, src->bulk_left, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        } else {
+            n = read(src->fd, buf, src->bulk_left < BULK_CHUNK ? src->bulk_left : BULK_CHUNK);
+            if (n > 0 && write(sink_fd, buf, n) != n) {
+                perror("sink write error");
+                return -1;
             }
         }
-        else if (p1_ready) {
-            if (read_from_pipe(fd1, "Pipe 1") == 0) active_producers--;
+        if (n == 0) {
+            fprintf(stderr, "Consumer: %s ended in a partial frame\n", src->name);
+            return 0;
         }
-        else if (p2_ready) {
-            if (read_from_pipe(fd2, "Pipe 2") == 0) active_producers--;
+        if (n == -1) {
+            if (errno == EAGAIN) return 1;
+            if (errno == EINTR) continue;
+            perror(cfg.zero_copy ? "splice error" : "read error");
+            return -1;
         }
+        src->bulk_left -= n;
+        bulk_bytes += n;
+        bulk_calls++;
     }
+}
+
+static void run_bulk_consumer(int epfd) {
+    int sink_fd = open(cfg.sink, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (sink_fd == -1) {
+        perror("sink open");
+        exit(1);
+    }
+    char *buf = cfg.zero_copy ? NULL : malloc(BULK_CHUNK);
+    struct epoll_event events[MAX_EVENTS];
+
+    printf("Consumer started. Forwarding %d B frames from %d producers to %s (%s path)...\n",
+           cfg.bulk_size, cfg.n_producers, cfg.sink, cfg.zero_copy ? "splice" : "copy");
+
+    int active = cfg.n_producers;
+    double start = now_sec(), cpu_start = cpu_seconds();
+
+    while (active > 0) {
+        int activity = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (activity < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait error");
+            break;
+        }
+        for (int k = 0; k < activity; k++) {
+            struct source *src = events[k].data.ptr;
+            if (bulk_forward(src, sink_fd, buf) <= 0) {
+                close(src->fd);
+                active--;
+            }
+        }
+    }
+
+    double elapsed = now_sec() - start, cpu = cpu_seconds() - cpu_start;
+    printf("Consumer: %ld frames, %.1f MB in %.3f s -> %.1f MB/s, %.1f KB per %s call\n",
+           bulk_frames, bulk_bytes / 1e6, elapsed, bulk_bytes / elapsed / 1e6,
+           bulk_calls ? bulk_bytes / 1e3 / bulk_calls : 0.0, cfg.zero_copy ? "splice" : "read");
+    printf("Consumer: %.3f s CPU -> %.3f s CPU per GB\n", cpu, bulk_bytes ? cpu * 1e9 / bulk_bytes : 0.0);
+    close(sink_fd);
+    free(buf);
+}
+
+static void __attribute__((noreturn)) usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-p producers] [-n messages per producer] [-b frames per write]\n"
+                    "          [-s random|rr|drr|prio] [-W w1,w2,...] [-q queue length] [-c us per message]\n"
+                    "          [-m select|epoll|uring | -T] [-r writes/s per producer]\n"
+                    "          [-f block|drop-oldest|drop-newest|sample [-B sensor buffer]]\n"
+                    "          [-z payload bytes [-Z] [-o sink]]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:b:s:W:q:c:z:Zo:m:r:f:B:T")) != -1) {
+        switch (opt) {
+            case 'p': cfg.n_producers = atoi(optarg); break;
+            case 'n': cfg.n_msgs = atol(optarg); break;
+            case 'b': cfg.burst = atoi(optarg); break;
+            case 'W': cfg.weights = optarg; break;
+            case 'q': cfg.queue_len = atoi(optarg); break;
+            case 'c': cfg.cost_us = atoi(optarg); break;
+            case 'z': cfg.bulk_size = atoi(optarg); break;
+            case 'Z': cfg.zero_copy = 1; break;
+            case 'o': cfg.sink = optarg; break;
+            case 'r': cfg.rate = atof(optarg); break;
+            case 'B': cfg.sensor_buf = atoi(optarg); break;
+            case 'T': cfg.backend = BACKEND_THREADS; break;
+            case 'f':
+                if (strcmp(optarg, "block") == 0) cfg.flow = FLOW_BLOCK;
+                else if (strcmp(optarg, "drop-oldest") == 0) cfg.flow = FLOW_DROP_OLDEST;
+                else if (strcmp(optarg, "drop-newest") == 0) cfg.flow = FLOW_DROP_NEWEST;
+                else if (strcmp(optarg, "sample") == 0) cfg.flow = FLOW_SAMPLE;
+                else if (strcmp(optarg, "none") != 0) usage(argv[0]);
+                break;
+            case 'm':
+                if (strcmp(optarg, "select") == 0) cfg.backend = BACKEND_SELECT;
+                else if (strcmp(optarg, "epoll") == 0) cfg.backend = BACKEND_EPOLL;
+                else if (strcmp(optarg, "uring") == 0) cfg.backend = BACKEND_URING;
+                else usage(argv[0]);
+                break;
+            case 's':
+                if (strcmp(optarg, "random") == 0) cfg.policy = POLICY_RANDOM;
+                else if (strcmp(optarg, "rr") == 0) cfg.policy = POLICY_RR;
+                else if (strcmp(optarg, "drr") == 0) cfg.policy = POLICY_DRR;
+                else if (strcmp(optarg, "prio") == 0) cfg.policy = POLICY_PRIO;
+                else usage(argv[0]);
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (cfg.n_producers < 1 || cfg.n_msgs < 0 || cfg.burst < 1 || cfg.queue_len < 1 || cfg.cost_us < 0)
+        usage(argv[0]);
+    if (cfg.bulk_size < 0 || (cfg.zero_copy && cfg.bulk_size == 0)) usage(argv[0]);
+    if (cfg.sensor_buf < 1 || (cfg.flow != FLOW_NONE && cfg.bulk_size > 0)) usage(argv[0]);
+    if (cfg.backend == BACKEND_THREADS && (cfg.bulk_size > 0 || cfg.flow != FLOW_NONE)) {
+        fprintf(stderr, "Threaded mode (-T) does not combine with -z or -f\n");
+        exit(1);
+    }
+    if (cfg.bulk_size > 0 && cfg.backend != BACKEND_EPOLL) {
+        fprintf(stderr, "Bulk mode (-z) runs on the epoll backend only\n");
+        exit(1);
+    }
+    if (cfg.bulk_size > 0 && cfg.n_msgs == 0) cfg.n_msgs = 1000; // Bulk mode is a benchmark
+
+    raise_fd_limit();
+
+    struct source *sources = calloc(cfg.n_producers, sizeof(struct source));
+    active = calloc(cfg.n_producers, sizeof(struct source *));
+    share_msgs = calloc(cfg.n_producers, sizeof(long));
+    share_bytes = calloc(cfg.n_producers, sizeof(long));
+
+    if (cfg.flow != FLOW_NONE) credit_setup();
+
+    // 1. Create Pipes and fork one Producer per pipe
+    // (threaded mode: one ring each, the threads start with the consumer)
+    if (cfg.backend == BACKEND_THREADS) spsc_setup();
+    for (int i = 0; i < cfg.n_producers && cfg.backend == BACKEND_THREADS; i++) {
+        sources[i].fd = -1;
+        sources[i].id = i;
+        sources[i].weight = 1;
+        snprintf(sources[i].name, sizeof(sources[i].name), "Ring %d", i + 1);
+    }
+    for (int i = 0; i < cfg.n_producers && cfg.backend != BACKEND_THREADS; i++) {
+        int fds[2];
+        if (pipe(fds) == -1) {
+            perror("pipe creation failed (raise ulimit -n for more producers)");
+            exit(1);
+        }
+        // Room for whole large frames; both paths get the same pipe
+        if (cfg.bulk_size > 0) fcntl(fds[0], F_SETPIPE_SZ, BULK_PIPE_SIZE);
+
+        if (fork() == 0) {
+            // Child P(i+1): close the read ends of the producers before us
+            for (int j = 0; j < i; j++) close(sources[j].fd);
+            close(fds[0]); // Close read end
+            if (cfg.bulk_size > 0) producer_bulk(i, fds[1]);
+            else if (cfg.flow != FLOW_NONE) producer_flow(i, fds[1]);
+            else producer(i, fds[1]);
+            exit(0);
+        }
+
+        close(fds[1]); // Close write end
+        sources[i].fd = fds[0];
+        sources[i].id = i;
+        sources[i].weight = 1;
+        snprintf(sources[i].name, sizeof(sources[i].name), "Pipe %d", i + 1);
+    }
+
+    // Weights, in producer order
+    const char *w = cfg.weights;
+    for (int i = 0; w && *w && i < cfg.n_producers; i++) {
+        sources[i].weight = atoi(w);
+        if (sources[i].weight < 1) sources[i].weight = 1;
+        w = strchr(w, ',');
+        if (w) w++;
+    }
+
+    // 2. Consumer (Parent Process) Logic
+    for (int i = 0; i < cfg.n_producers; i++)
+        sources[i].queue = malloc(cfg.queue_len * sizeof(struct queued_msg));
+
+    all_sources = sources;
+
+    if (cfg.backend == BACKEND_EPOLL) {
+        ep_fd = epoll_create1(0);
+        if (ep_fd == -1) {
+            perror("epoll_create1");
+            exit(1);
+        }
+
+        // Edge-triggered: one wakeup per burst, so every ready pipe is
+        // drained completely before we wait again
+        for (int i = 0; i < cfg.n_producers; i++) {
+            fcntl(sources[i].fd, F_SETFL, O_NONBLOCK);
+            struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = &sources[i] };
+            if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, sources[i].fd, &ev) == -1) {
+                perror("epoll_ctl ADD");
+                exit(1);
+            }
+        }
+    } else if (cfg.backend == BACKEND_SELECT) {
+        for (int i = 0; i < cfg.n_producers; i++) {
+            if (sources[i].fd >= FD_SETSIZE) {
+                fprintf(stderr, "select() cannot watch fd %d, use -m epoll or -m uring\n", sources[i].fd);
+                exit(1);
+            }
+            fcntl(sources[i].fd, F_SETFL, O_NONBLOCK);
+        }
+    } else {
+        uring_setup();
+    }
+
+    if (cfg.bulk_size > 0) {
+        run_bulk_consumer(ep_fd);
+        close(ep_fd);
+        while (wait(NULL) > 0);
+        for (int i = 0; i < cfg.n_producers; i++) free(sources[i].queue);
+        free(sources);
+        free(active);
+        free(share_msgs);
+        free(share_bytes);
+        return 0;
+    }
+
+    long wakeups = 0;
+
+    // Seed random for the fair choice logic
+    srand(time(NULL));
+
+    printf("Consumer started. Monitoring %d producer %s (%s, %s scheduling)...\n",
+           cfg.n_producers, cfg.backend == BACKEND_THREADS ? "rings" : "pipes",
+           backend_name[cfg.backend], policy_name[cfg.policy]);
+
+    active_producers = cfg.n_producers;
+    double start = now_sec(), cpu_start = cpu_seconds();
+
+    // Threaded mode: CPU time now covers the producers too
+    for (int i = 0; i < cfg.n_producers && cfg.backend == BACKEND_THREADS; i++) {
+        if (pthread_create(&producer_threads[i], NULL, producer_thread, (void *)(intptr_t)i) != 0) {
+            fprintf(stderr, "pthread_create failed for producer %d\n", i + 1);
+            exit(1);
+        }
+    }
+
+    // io_uring: post the first read on every pipe
+    if (cfg.backend == BACKEND_URING)
+        for (int i = 0; i < cfg.n_producers; i++) ingest(&sources[i]);
+
+    while (active_producers > 0 || total_queued > 0) {
+        // --- THE WAIT ---
+        // With work queued we only poll; otherwise, if no data
+        // arrives in 2s, do something else
+        int activity = backend_wait(total_queued > 0 ? 0 : 2000);
+        if (activity < 0) break;
+
+        if (activity == 0 && total_queued == 0) {
+            printf("Consumer: Idle... waiting for data.\n");
+            continue;
+        }
+        if (activity > 0) wakeups++;
+
+        // --- FAIRNESS LOGIC ---
+        // The policy picks whose message is processed next
+        for (int k = 0; k < SERVE_BATCH && act_count > 0; k += schedule());
+    }
+
+    double elapsed = now_sec() - start, cpu = cpu_seconds() - cpu_start;
 
     printf("All producers finished. Consumer exiting.\n");
-    
+    if (!VERBOSE) {
+        printf("Consumer: %ld messages from %d producers in %.3f s, %ld wakeups (%.1f messages each)\n",
+               total_received, cfg.n_producers, elapsed, wakeups,
+               wakeups ? (double)total_received / wakeups : 0.0);
+        printf("Consumer: %ld reads, %.1f messages per read, %.0f messages/s, %.1f MB/s\n",
+               total_reads, total_reads ? (double)total_received / total_reads : 0.0,
+               total_received / elapsed, total_bytes / elapsed / 1e6);
+        printf("Consumer: %s backend, %ld syscalls -> %.3f per message; "
+               "delay p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n",
+               backend_name[cfg.backend], total_syscalls,
+               total_received ? (double)total_syscalls / total_received : 0.0,
+               delay_percentile(0.50), delay_percentile(0.99), delay_percentile(0.999));
+        printf("Consumer: %.3f s CPU -> %.3f us CPU per message\n",
+               cpu, total_received ? cpu * 1e6 / total_received : 0.0);
+        print_fairness(sources);
+        if (out_of_order)
+            printf("Consumer: %ld messages out of order\n", out_of_order);
+    }
+
+    // Producer counters are final once they have all exited
+    while (wait(NULL) > 0);
+    if (credits && !VERBOSE) print_flow();
+    if (cfg.backend == BACKEND_THREADS) {
+        long spins = 0, parks = 0;
+        for (int i = 0; i < cfg.n_producers; i++) {
+            pthread_join(producer_threads[i], NULL);
+            spins += rings[i].spins;
+            parks += rings[i].parks;
+        }
+        if (!VERBOSE)
+            printf("Threads: consumer parked %ld times, woke producers %ld times; "
+                   "producers spun %ld polls on a full ring, parked %ld times, woke the consumer %ld times\n",
+                   consumer_parks, futex_wakes, spins, parks, atomic_load(&producer_wakes));
+        munmap(rings, cfg.n_producers * sizeof(struct spsc_ring));
+        free(producer_threads);
+    }
+
     // Cleanup
-    close(fd1);
-    close(fd2);
-    wait(NULL);
-    wait(NULL);
+    if (ep_fd != -1) close(ep_fd);
+    if (cfg.backend == BACKEND_URING) close(ring.fd);
+    for (int i = 0; i < cfg.n_producers; i++) free(sources[i].queue);
+    free(sources);
+    free(active);
+    free(share_msgs);
+    free(share_bytes);
 
     return 0;
-}
\ No newline at end of file
+}
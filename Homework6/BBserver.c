@@ -1,42 +1,608 @@
+#define _GNU_SOURCE // ppoll()
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <stdint.h>
 #include <time.h>
 #include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
-// Protocol: We send simple integers
-#define ACK 1
+// Protocol: We send simple integers. A writer's ACK is the number of
+// its writes applied so far, so a repeated ACK can be told apart.
 #define READ_REQ 999
 
-// --- WRITER PROCESS (W0 and W1) ---
+// ============================================================
+// BATCHED PROTOCOL ("-p batch")
+// Every message is a frame header followed by `count` entries.
+// Writers pipeline up to WINDOW frames in one writev(); the server
+// applies every queued frame per wakeup and answers with one
+// coalesced ACK frame. A write whose guard is closed is queued behind
+// the cell's earlier ones and applied in order once the guard opens,
+// so every acknowledged write is applied, as in the int protocol.
+// ============================================================
+#define FRAME_WRITE  1  // W -> S: count x {cell, value}
+#define FRAME_READ   2  // R -> S: count x {cell, unused}
+#define FRAME_ACK    3  // S -> W: count = frames acknowledged, seq = last one
+#define FRAME_VALUES 4  // S -> R: count x {cell, value}
+#define FRAME_SUBSCRIBE 5 // R -> S: count x {cell, unused}, sent once ("-s")
+#define FRAME_UPDATE 6  // S -> R: count x {cell, gen, value}, pushed
+
+#define BATCH_MAX 64    // Entries per frame
+#define WINDOW    8     // Frames in flight per client
+
+struct bb_frame {
+    uint16_t type;
+    uint16_t count;
+    uint32_t seq;
+};
+
+struct bb_entry {
+    int32_t cell;
+    int32_t value;
+};
+
+// Pushed change notification. gen counts every write to the cell, so
+// rewriting the same value is still visible; a jump in gen means the
+// server conflated updates because the reader fell behind.
+struct bb_update {
+    int32_t cell;
+    uint32_t gen;
+    int32_t value;
+};
+
+#define FRAME_MAX_SIZE (sizeof(struct bb_frame) + BATCH_MAX * sizeof(struct bb_entry))
+#define RX_BUF_SIZE    (WINDOW * FRAME_MAX_SIZE)
+
+#define PROTO_INT   0   // One int per message (original)
+#define PROTO_BATCH 1
+
+// Transport selection (positional argument): "pipe" (default) or "shm"
+#define MODE_PIPE 0
+#define MODE_SHM  1
+
+#define SHM_NAME "/bb_blackboard"
+
+// Durability ("-d"): where the pipe server persists the blackboard
+#define DUR_NONE  0     // Memory only (original)
+#define DUR_BATCH 1     // WAL, one fdatasync per loop iteration (group commit)
+#define DUR_WRITE 2     // WAL, one fdatasync per write
+
+#define WAL_FILE      "bb_wal.log"
+#define SNAP_FILE     "bb_snapshot.bin"
+#define SNAP_TMP_FILE "bb_snapshot.tmp"
+#define SNAP_INTERVAL 5.0       // Seconds between snapshots
+#define SNAP_WAL_MAX  (1 << 20) // ... or WAL records, whichever comes first
+
+// Max events handled per epoll_wait() wakeup
+#define MAX_EVENTS 64
+
+// Blackboard layout, set from the command line
+struct bb_config {
+    int mode;
+    int proto;
+    long n_ops;     // Writes per writer; 0 = run forever at human speed
+    int subscribe;  // Readers subscribe once and get pushed updates
+    int n_writers;  // Writer i owns cell (i % n_cells)
+    int n_readers;  // Reader i watches cell (i % n_cells)
+    int n_cells;
+    const char *rule_file;  // Guard rules, NULL = built-in pair rule
+    int durability;
+    int n_shards;   // Server threads, 0 = classic single-threaded loop
+    int bench;      // Load generator: latency histograms, JSON report
+    double rate;    // Per-writer writes/s for open-loop load, 0 = closed loop
+    int replicate;  // Hot-standby follower serves the readers
+    long kill_after; // Failover test: the leader dies after this many writes
+};
+
+static struct bb_config cfg = { MODE_PIPE, PROTO_INT, 0, 0, 2, 2, 2, NULL, DUR_NONE, 0, 0, 0, 0, 0 };
+
+// Per-operation logging only makes sense at human speed
+#define VERBOSE (cfg.n_ops == 0)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Cells handled by client `id` out of `n_owners` of the same kind:
+// every cell c with c % n_owners == id, or just (id % n_cells) when
+// there are more clients than cells. Returns the count.
+static int owned_cells(int id, int n_owners, int *out) {
+    int n = 0;
+    if (n_owners >= cfg.n_cells) {
+        out[n++] = id % cfg.n_cells;
+        return n;
+    }
+    for (int c = id; c < cfg.n_cells; c += n_owners) out[n++] = c;
+    return n;
+}
+
+// Bitmaps (64 bits per word)
+#define BITMAP_WORDS(n) (((n) + 63) / 64)
+
+static int bit_test(const uint64_t *b, int i) { return (b[i >> 6] >> (i & 63)) & 1; }
+static void bit_set(uint64_t *b, int i) { b[i >> 6] |= 1ULL << (i & 63); }
+static void bit_clear(uint64_t *b, int i) { b[i >> 6] &= ~(1ULL << (i & 63)); }
+
+// ============================================================
+// GUARD RULE ENGINE
+// Writer admission is a table of rules "a OP b": cell a may only be
+// written while cells[a] OP cells[b]; all rules on a cell must hold.
+// The table is loaded once ("-g file", default: cells paired 0-1,
+// 2-3, ... with the original W0/W1 rule "a <= partner") and compiled
+// into two indexes:
+//   rules of cell a -> what to evaluate for a
+//   deps of cell c  -> cells whose guard mentions c, i.e. the only
+//                      guards a write to c can change
+// ============================================================
+#define OP_LT 0
+#define OP_LE 1
+#define OP_EQ 2
+#define OP_NE 3
+#define OP_GE 4
+#define OP_GT 5
+
+struct guard_rule {
+    int cell;   // Guarded cell
+    int op;
+    int other;  // Cell it is compared with
+};
+
+static struct guard_rule *rules = NULL;
+static int n_rules = 0;
+static int *rules_off = NULL, *rules_idx = NULL;   // Rules guarding each cell
+static int *deps_off = NULL, *deps_idx = NULL;     // Cells to re-check per written cell
+
+// Live writers per cell (pipe server only). A partner nobody can
+// write anymore must not block its cell forever.
+static int *cell_writers = NULL;
+
+static int parse_op(const char *s) {
+    static const char *names[] = { "<", "<=", "==", "!=", ">=", ">" };
+    for (int op = OP_LT; op <= OP_GT; op++)
+        if (strcmp(s, names[op]) == 0) return op;
+    return -1;
+}
+
+static void add_rule(int cell, int op, int other) {
+    rules = realloc(rules, (n_rules + 1) * sizeof(struct guard_rule));
+    rules[n_rules].cell = cell;
+    rules[n_rules].op = op;
+    rules[n_rules].other = other;
+    n_rules++;
+}
+
+// Rule file: one "a OP b" per line, '#' starts a comment
+static void load_rules(const char *path) {
+    char line[128], op[4];
+    int a, b, lineno = 0;
+
+    if (path == NULL) {
+        for (int c = 0; c < cfg.n_cells; c++)
+            if ((c ^ 1) < cfg.n_cells) add_rule(c, OP_LE, c ^ 1);
+        return;
+    }
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("rule file");
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        if (strspn(line, " \t\r\n") == strlen(line)) continue;
+        if (sscanf(line, "%d %3s %d", &a, op, &b) != 3 || parse_op(op) == -1 ||
+            a < 0 || a >= cfg.n_cells || b < 0 || b >= cfg.n_cells) {
+            fprintf(stderr, "%s:%d: bad rule (expected \"cell OP cell\")\n", path, lineno);
+            exit(1);
+        }
+        add_rule(a, parse_op(op), b);
+    }
+    fclose(fp);
+}
+
+static int cmp_pair(const void *x, const void *y) {
+    const int *p = x, *q = y;
+    if (p[0] != q[0]) return p[0] - q[0];
+    return p[1] - q[1];
+}
+
+// Builds both indexes as offset arrays (CSR): entries for cell c are
+// idx[off[c]] .. idx[off[c + 1] - 1]
+static void compile_rules(void) {
+    int n = cfg.n_cells;
+    rules_off = calloc(n + 1, sizeof(int));
+    rules_idx = malloc((n_rules + 1) * sizeof(int));
+    for (int r = 0; r < n_rules; r++) rules_off[rules[r].cell + 1]++;
+    for (int c = 0; c < n; c++) rules_off[c + 1] += rules_off[c];
+    int *fill = malloc(n * sizeof(int));
+    memcpy(fill, rules_off, n * sizeof(int));
+    for (int r = 0; r < n_rules; r++) rules_idx[fill[rules[r].cell]++] = r;
+    free(fill);
+
+    // (written cell, guarded cell) pairs, sorted and deduplicated
+    int *pairs = malloc((2 * n_rules + 1) * 2 * sizeof(int));
+    int n_pairs = 0;
+    for (int r = 0; r < n_rules; r++) {
+        pairs[2 * n_pairs] = rules[r].cell;  pairs[2 * n_pairs + 1] = rules[r].cell;  n_pairs++;
+        pairs[2 * n_pairs] = rules[r].other; pairs[2 * n_pairs + 1] = rules[r].cell;  n_pairs++;
+    }
+    qsort(pairs, n_pairs, 2 * sizeof(int), cmp_pair);
+    deps_off = calloc(n + 1, sizeof(int));
+    deps_idx = malloc((n_pairs + 1) * sizeof(int));
+    int n_deps = 0;
+    for (int i = 0; i < n_pairs; i++) {
+        if (i > 0 && pairs[2 * i] == pairs[2 * i - 2] && pairs[2 * i + 1] == pairs[2 * i - 1]) continue;
+        deps_idx[n_deps++] = pairs[2 * i + 1];
+        deps_off[pairs[2 * i] + 1]++;
+    }
+    for (int c = 0; c < n; c++) deps_off[c + 1] += deps_off[c];
+    free(pairs);
+}
+
+// Loads are atomic because shard threads ("-t") share these arrays
+static int rule_holds(const int *cells, const struct guard_rule *r) {
+    if (cell_writers && __atomic_load_n(&cell_writers[r->other], __ATOMIC_RELAXED) == 0) return 1;
+    int a = __atomic_load_n(&cells[r->cell], __ATOMIC_RELAXED);
+    int b = __atomic_load_n(&cells[r->other], __ATOMIC_RELAXED);
+    switch (r->op) {
+        case OP_LT: return a < b;
+        case OP_LE: return a <= b;
+        case OP_EQ: return a == b;
+        case OP_NE: return a != b;
+        case OP_GE: return a >= b;
+        default:    return a > b;
+    }
+}
+
+// Writer guard, shared by both transports. A cell without rules is
+// always writable.
+static int writer_allowed(const int *cells, int c) {
+    for (int k = rules_off[c]; k < rules_off[c + 1]; k++)
+        if (!rule_holds(cells, &rules[rules_idx[k]])) return 0;
+    return 1;
+}
+
+// ============================================================
+// SHARED-MEMORY BLACKBOARD
+// Each cell is guarded by a seqlock: the sequence number is odd
+// while a write is in progress and even when the value is stable.
+// Readers and writers touch the cells directly; the server only
+// hands out write grants (the writer guards) through futex words.
+// A writer that has sent its -n writes leaves GRANT_DONE in its grant
+// word, so the server stops guarding its partners and, once all are
+// done, closes the board. Writers also flag their cell in the changed
+// bitmap (atomic OR), so on a doorbell the server only re-evaluates
+// the guards that read those cells (deps_off/deps_idx), like the
+// pipe server does.
+// ============================================================
+#define GRANT_DONE 2
+struct shm_cell {
+    atomic_uint seq;    // Seqlock counter, also the futex readers sleep on
+    atomic_int value;
+};
+
+struct shm_board {
+    atomic_uint doorbell;   // Bumped by writers to wake the server
+    atomic_int closed;      // All writers done: readers exit
+    struct shm_cell cell[]; // n_cells cells, then the changed bitmap, then n_writers grant words
+};
+
+static struct shm_board *board = NULL;
+static _Atomic uint64_t *changed = NULL;   // Cells written since the server last looked
+static atomic_uint *grants = NULL;  // 1 = server allows writer i to write once, GRANT_DONE = finished
+
+static void futex_wait(atomic_uint *addr, unsigned expected) {
+    syscall(SYS_futex, addr, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+}
+
+// Called after the grant word is updated, so a server that sees the
+// bit also sees the grant consumed
+static void ring_server(int cell) {
+    uint64_t bit = 1ULL << (cell & 63);
+    atomic_fetch_or(&changed[cell >> 6], bit);
+    atomic_fetch_add(&board->doorbell, 1);
+    futex_wake(&board->doorbell);
+}
+
+static void seq_write(struct shm_cell *c, int val) {
+    atomic_fetch_add(&c->seq, 1);  // Odd: write in progress
+    atomic_store_explicit(&c->value, val, memory_order_relaxed);
+    atomic_fetch_add(&c->seq, 1);  // Even: stable again
+    futex_wake(&c->seq);
+}
+
+// Returns a consistent value and stores the matching sequence in *seq_out
+static int seq_read(struct shm_cell *c, unsigned *seq_out) {
+    unsigned s1, s2;
+    int val;
+    do {
+        s1 = atomic_load(&c->seq);
+        val = atomic_load_explicit(&c->value, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&c->seq, memory_order_relaxed);
+    } while ((s1 & 1) || s1 != s2);
+    *seq_out = s1;
+    return val;
+}
+
+static struct shm_board *create_board(void) {
+    size_t size = sizeof(struct shm_board)
+                + cfg.n_cells * sizeof(struct shm_cell)
+                + BITMAP_WORDS(cfg.n_cells) * sizeof(uint64_t)
+                + cfg.n_writers * sizeof(atomic_uint);
+
+    int fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
+    if (fd == -1) {
+        perror("shm_open");
+        exit(1);
+    }
+    if (ftruncate(fd, size) == -1) {
+        perror("ftruncate");
+        exit(1);
+    }
+    struct shm_board *b = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (b == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    close(fd);
+    // Children inherit the mapping, so the name is not needed anymore
+    shm_unlink(SHM_NAME);
+    memset(b, 0, size);
+    changed = (_Atomic uint64_t *)&b->cell[cfg.n_cells];
+    grants = (atomic_uint *)&changed[BITMAP_WORDS(cfg.n_cells)];
+    return b;
+}
+
+// ============================================================
+// BENCHMARK MODE ("-b")
+// Writers and readers record latencies into log-linear histograms
+// (16 sub-buckets per power of two, ~6% resolution) that live in a
+// shared mapping, one per client, so main() can merge them after the
+// run. Write latency is send -> ACK (open loop: scheduled send time
+// -> ACK, so a stalled server is not hidden; shm: start waiting for
+// the grant -> value published). Propagation latency is
+// write -> delivery at a reader: writers write unique increasing
+// values and stamp the send time in a per-cell ring that readers
+// look up by value.
+// ============================================================
+#define HIST_SUB     16
+#define HIST_BUCKETS (64 * HIST_SUB)
+#define STAMP_RING   256
+
+struct histogram {
+    uint64_t count;
+    uint64_t max;
+    uint64_t bucket[HIST_BUCKETS];
+};
+
+struct stamp {
+    atomic_int value;       // Which write the time belongs to
+    atomic_ullong sent_ns;
+};
+
+static struct histogram *bench_hist = NULL; // [n_writers + n_readers]
+static struct stamp *bench_stamps = NULL;   // [n_cells][STAMP_RING]
+static long bench_writes = 0;               // Filled in by the server: applied
+static long bench_offered = 0;              // ... and sent by the writers
+static double bench_seconds = 0;
+
+static int hist_index(uint64_t ns) {
+    if (ns < HIST_SUB) return ns;
+    int exp = 63 - __builtin_clzll(ns);
+    return (exp - 3) * HIST_SUB + ((ns >> (exp - 4)) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_value(int i) {
+    if (i < HIST_SUB) return i;
+    int exp = i / HIST_SUB + 3;
+    return (uint64_t)(HIST_SUB + i % HIST_SUB) << (exp - 4);
+}
+
+static void hist_add(struct histogram *h, uint64_t ns) {
+    h->bucket[hist_index(ns)]++;
+    h->count++;
+    if (ns > h->max) h->max = ns;
+}
+
+static void hist_merge(struct histogram *into, const struct histogram *h) {
+    for (int i = 0; i < HIST_BUCKETS; i++) into->bucket[i] += h->bucket[i];
+    into->count += h->count;
+    if (h->max > into->max) into->max = h->max;
+}
+
+static uint64_t hist_percentile(const struct histogram *h, double q) {
+    uint64_t target = (uint64_t)(q * h->count), seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen > target) return hist_value(i);
+    }
+    return h->max;
+}
+
+static void bench_setup(void) {
+    int n_clients = cfg.n_writers + cfg.n_readers;
+    size_t hist_size = n_clients * sizeof(struct histogram);
+    size_t stamp_size = (size_t)cfg.n_cells * STAMP_RING * sizeof(struct stamp);
+    bench_hist = mmap(NULL, hist_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    bench_stamps = mmap(NULL, stamp_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (bench_hist == MAP_FAILED || bench_stamps == MAP_FAILED) {
+        perror("bench mmap");
+        exit(1);
+    }
+}
+
+// Value a writer sends as its n-th write. Benchmark values are unique
+// per cell and increase, so the guards still alternate the writers.
+static int next_value(int id, long n) {
+    if (!cfg.bench) return rand() % 100;
+    return (int)(n * cfg.n_writers + id + 1);
+}
+
+static void stamp_write(int cell, int value, uint64_t t) {
+    if (!cfg.bench) return;
+    struct stamp *st = &bench_stamps[(size_t)cell * STAMP_RING + value % STAMP_RING];
+    atomic_store(&st->value, -1);   // Invalidate while updating
+    atomic_store(&st->sent_ns, t);
+    atomic_store(&st->value, value);
+}
+
+// Reader side: record how long (cell, value) took to arrive
+static void stamp_delivered(int reader_id, int cell, int value) {
+    if (!cfg.bench || value <= 0) return;
+    struct stamp *st = &bench_stamps[(size_t)cell * STAMP_RING + value % STAMP_RING];
+    uint64_t t = atomic_load(&st->sent_ns);
+    if (atomic_load(&st->value) != value) return; // Overwritten by a newer write
+    hist_add(&bench_hist[cfg.n_writers + reader_id], now_ns() - t);
+}
+
+static void print_latency(const char *name, const struct histogram *h) {
+    printf("\"%s\":{\"count\":%llu,\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}",
+           name, (unsigned long long)h->count,
+           hist_percentile(h, 0.50) / 1e3, hist_percentile(h, 0.99) / 1e3,
+           hist_percentile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+// One JSON line per run, latencies in microseconds
+static void bench_report(void) {
+    struct histogram w, r;
+    memset(&w, 0, sizeof(w));
+    memset(&r, 0, sizeof(r));
+    for (int i = 0; i < cfg.n_writers; i++) hist_merge(&w, &bench_hist[i]);
+    for (int i = 0; i < cfg.n_readers; i++) hist_merge(&r, &bench_hist[cfg.n_writers + i]);
+
+    printf("{\"transport\":\"%s\",\"proto\":\"%s\",\"subscribe\":%d,\"shards\":%d,\"durability\":%d,"
+           "\"writers\":%d,\"readers\":%d,\"cells\":%d,\"rate\":%.0f,"
+           "\"offered\":%ld,\"writes\":%ld,\"seconds\":%.3f,\"writes_per_s\":%.0f,",
+           cfg.mode == MODE_SHM ? "shm" : "pipe",
+           cfg.proto == PROTO_BATCH ? "batch" : "int", cfg.subscribe, cfg.n_shards,
+           cfg.durability, cfg.n_writers, cfg.n_readers, cfg.n_cells, cfg.rate,
+           bench_offered, bench_writes, bench_seconds, bench_seconds > 0 ? bench_writes / bench_seconds : 0.0);
+    print_latency("write_latency_us", &w);
+    printf(",");
+    print_latency("propagation_latency_us", &r);
+    printf("}\n");
+}
+
+// --- OPEN-LOOP WRITER ("-b -R rate") ---
+// Sends on a fixed schedule whether or not ACKs came back; latency is
+// measured from the scheduled time. At most STAMP_RING writes are
+// outstanding, beyond that the writer has to wait (overload).
+void run_writer_open_loop(int id, int fd_write, int fd_read) {
+    uint64_t interval = 1e9 / cfg.rate;
+    uint64_t next = now_ns();
+    uint64_t *sched = malloc(STAMP_RING * sizeof(uint64_t));
+    struct histogram *h = &bench_hist[id];
+    int cell = id % cfg.n_cells;
+    long sent = 0, acked = 0;
+    int val, ack;
+
+    while (acked < cfg.n_ops) {
+        uint64_t now = now_ns();
+        if (sent < cfg.n_ops && now >= next && sent - acked < STAMP_RING) {
+            val = next_value(id, sent);
+            stamp_write(cell, val, next);
+            sched[sent % STAMP_RING] = next;
+            if (write(fd_write, &val, sizeof(int)) == -1) break;
+            sent++;
+            next += interval;
+            continue;
+        }
+
+        // Sleep until the next send is due or an ACK arrives
+        struct pollfd pfd = { fd_read, POLLIN, 0 };
+        struct timespec ts = { 0, 0 };
+        int wait_forever = sent == cfg.n_ops || sent - acked >= STAMP_RING;
+        if (!wait_forever && next > now) {
+            ts.tv_sec = (next - now) / 1000000000ull;
+            ts.tv_nsec = (next - now) % 1000000000ull;
+        }
+        if (ppoll(&pfd, 1, wait_forever ? NULL : &ts, NULL) <= 0) continue;
+        if (read(fd_read, &ack, sizeof(int)) <= 0) break;
+        if (ack <= acked) continue; // Repeated by the follower after a failover
+        hist_add(h, now_ns() - sched[acked % STAMP_RING]);
+        acked++;
+    }
+    free(sched);
+}
+
+// --- WRITER PROCESS (W0 .. Wn) ---
 void run_writer(int id, int fd_write, int fd_read) {
     srand(time(NULL) + id); // Unique seed
-    int val, ack;
+    int val, ack, got;
+    int cell = id % cfg.n_cells;
+    uint64_t t0 = 0;
 
-    while(1) {
+    if (cfg.bench && cfg.rate > 0) {
+        run_writer_open_loop(id, fd_write, fd_read);
+        return;
+    }
+
+    for (long n = 0; cfg.n_ops == 0 || n < cfg.n_ops; n++) {
         // Generate random integer (0-100)
-        val = rand() % 100;
+        val = next_value(id, n);
+
+        if (cfg.bench) {
+            t0 = now_ns();
+            stamp_write(cell, val, t0);
+        }
 
         // Send "Request to Write"
-        // This will BLOCK here if the Server ignores us via select()
+        // This will BLOCK here if the Server has disarmed us
         write(fd_write, &val, sizeof(int));
 
-        // Wait for Server Acknowledgment
-        read(fd_read, &ack, sizeof(int));
+        // Wait for Server Acknowledgment. After a failover the follower
+        // may repeat the ACK of our previous write: skip it
+        while ((got = read(fd_read, &ack, sizeof(int)) > 0) && ack <= n)
+            ;
+        if (!got) break;
+
+        if (cfg.bench) hist_add(&bench_hist[id], now_ns() - t0);
 
-        printf("[W%d] Successfully wrote: %d\n", id, val);
-        
-        usleep(500000); // Sleep 0.5s
+        if (VERBOSE) {
+            printf("[W%d] Successfully wrote: %d\n", id, val);
+            usleep(500000); // Sleep 0.5s
+        }
     }
 }
 
-// --- READER PROCESS (R0 and R1) ---
+// --- READER PROCESS (R0 .. Rn) ---
 void run_reader(int id, int fd_write, int fd_read) {
     int req = READ_REQ;
     int received_val;
-    char filename[20];
+    int cell = id % cfg.n_cells;
+    char filename[32];
     sprintf(filename, "log_R%d.txt", id);
 
     // Clear log file
@@ -49,169 +615,1910 @@ void run_reader(int id, int fd_write, int fd_read) {
         write(fd_write, &req, sizeof(int));
 
         // Read the Value
-        read(fd_read, &received_val, sizeof(int));
+        if (read(fd_read, &received_val, sizeof(int)) <= 0) break;
+
+        if (cfg.bench) {
+            stamp_delivered(id, cell, received_val);
+            continue;
+        }
 
         // Log it
         fp = fopen(filename, "a");
         if (fp) {
-            fprintf(fp, "New Value in Cell %d: %d\n", id, received_val);
+            fprintf(fp, "New Value in Cell %d: %d\n", cell, received_val);
             fclose(fp);
         }
-        printf("    [R%d] Logged new value: %d\n", id, received_val);
+        if (VERBOSE) printf("    [R%d] Logged new value: %d\n", id, received_val);
     }
 }
 
-// --- SERVER PROCESS (The Blackboard) ---
-void run_server(int p_w0[2], int p_w1[2], int p_r0[2], int p_r1[2]) {
-    int cell[2] = {0, 0};       // The Blackboard Memory
-    int last_sent[2] = {-1, -1}; // To track changes for readers
-    int val, temp;
+static int read_full(int fd, void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = read(fd, (char *)buf + done, len - done);
+        if (r <= 0) return -1;
+        done += r;
+    }
+    return 0;
+}
+
+// --- BATCH WRITER ---
+// Keeps up to WINDOW frames of BATCH_MAX writes in flight, spread
+// over all the cells this writer owns.
+void run_writer_batch(int id, int fd_write, int fd_read) {
+    static struct bb_frame hdr[WINDOW];
+    static struct bb_entry ent[WINDOW][BATCH_MAX];
+    struct iovec iov[2 * WINDOW];
+    struct bb_frame ack;
+    int *mine = malloc(cfg.n_cells * sizeof(int));
+    int n_mine = owned_cells(id, cfg.n_writers, mine);
+    int in_flight = 0, next = 0;
+    uint32_t seq = 0, acked_seq = 0;
+    uint64_t sent_at[WINDOW];
+    long sent = 0;
+
+    srand(time(NULL) + id);
+
+    while (cfg.n_ops == 0 || sent < cfg.n_ops || in_flight > 0) {
+        // Fill the free part of the window and send it with one writev
+        int nf = 0;
+        while (in_flight + nf < WINDOW && (cfg.n_ops == 0 || sent < cfg.n_ops)) {
+            int count = BATCH_MAX;
+            if (cfg.n_ops && cfg.n_ops - sent < count) count = cfg.n_ops - sent;
+            uint64_t t = cfg.bench ? now_ns() : 0;
+            for (int k = 0; k < count; k++) {
+                ent[nf][k].cell = mine[next % n_mine];
+                ent[nf][k].value = next_value(id, next);
+                stamp_write(ent[nf][k].cell, ent[nf][k].value, t);
+                next++;
+            }
+            sent_at[seq % WINDOW] = t;
+            hdr[nf].type = FRAME_WRITE;
+            hdr[nf].count = count;
+            hdr[nf].seq = seq++;
+            iov[2 * nf].iov_base = &hdr[nf];
+            iov[2 * nf].iov_len = sizeof(struct bb_frame);
+            iov[2 * nf + 1].iov_base = ent[nf];
+            iov[2 * nf + 1].iov_len = count * sizeof(struct bb_entry);
+            sent += count;
+            nf++;
+        }
+        if (nf > 0 && writev(fd_write, iov, 2 * nf) == -1) break;
+        in_flight += nf;
+
+        // One ACK frame may acknowledge several of our frames
+        if (read_full(fd_read, &ack, sizeof(ack)) == -1) break;
+        in_flight -= ack.count;
+        if (cfg.bench) {
+            uint64_t t = now_ns();
+            for (int k = 0; k < ack.count; k++, acked_seq++)
+                hist_add(&bench_hist[id], t - sent_at[acked_seq % WINDOW]);
+        }
+
+        if (VERBOSE) {
+            printf("[W%d] %d frames acknowledged (up to #%u)\n", id, ack.count, ack.seq);
+            usleep(500000);
+        }
+    }
+    free(mine);
+}
+
+// --- BATCH READER ---
+// Multi-get over every cell this reader owns. Two requests are kept
+// in flight so the next answer is already queued while we log.
+void run_reader_batch(int id, int fd_write, int fd_read) {
+    struct bb_entry req[BATCH_MAX], vals[BATCH_MAX];
+    struct bb_frame hdr, rep;
+    struct iovec iov[4];
+    int *mine = malloc(cfg.n_cells * sizeof(int));
+    int n_mine = owned_cells(id, cfg.n_readers, mine);
+    uint32_t seq = 0;
+    char filename[32];
+    sprintf(filename, "log_R%d.txt", id);
 
-    // Inputs (Server reads from these)
-    int fd_w0_in = p_w0[0];
-    int fd_w1_in = p_w1[0];
-    int fd_r0_in = p_r0[0];
-    int fd_r1_in = p_r1[0];
+    if (n_mine > BATCH_MAX) n_mine = BATCH_MAX;
+    for (int k = 0; k < n_mine; k++) req[k].cell = mine[k];
 
-    // Outputs (Server writes to these)
-    int fd_w0_out = p_w0[1];
-    int fd_w1_out = p_w1[1];
-    int fd_r0_out = p_r0[1];
-    int fd_r1_out = p_r1[1];
+    FILE *fp = fopen(filename, "w");
+    if (fp) { fprintf(fp, "--- Log R%d ---\n", id); fclose(fp); }
 
-    printf("[Server] Blackboard Started. State: [%d, %d]\n", cell[0], cell[1]);
+    hdr.type = FRAME_READ;
+    hdr.count = n_mine;
+    for (int k = 0; k < 2; k++) {
+        iov[2 * k].iov_base = &hdr;
+        iov[2 * k].iov_len = sizeof(hdr);
+        iov[2 * k + 1].iov_base = req;
+        iov[2 * k + 1].iov_len = n_mine * sizeof(struct bb_entry);
+    }
+    seq += 2;
+    if (writev(fd_write, iov, 4) == -1) return;
 
     while(1) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        int max_fd = 0;
+        if (read_full(fd_read, &rep, sizeof(rep)) == -1) break;
+        if (read_full(fd_read, vals, rep.count * sizeof(struct bb_entry)) == -1) break;
 
-        // ============================================================
-        // THE LOGIC GUARDS
-        // Only add FDs to the set if the Blackboard rules allow it!
-        // ============================================================
+        // Re-issue immediately to keep the pipeline full
+        hdr.seq = seq++;
+        if (writev(fd_write, iov, 2) == -1) break;
+
+        if (cfg.bench) {
+            for (int k = 0; k < rep.count; k++) stamp_delivered(id, vals[k].cell, vals[k].value);
+            continue;
+        }
+
+        fp = fopen(filename, "a");
+        if (fp) {
+            for (int k = 0; k < rep.count; k++)
+                fprintf(fp, "New Value in Cell %d: %d\n", vals[k].cell, vals[k].value);
+            fclose(fp);
+        }
+        if (VERBOSE) printf("    [R%d] Logged %d values\n", id, rep.count);
+    }
+    free(mine);
+}
+
+// --- SUBSCRIBING READER ("-s") ---
+// Registers interest in its cells once, then only receives pushes.
+void run_reader_sub(int id, int fd_write, int fd_read) {
+    struct bb_entry req[BATCH_MAX];
+    struct bb_update upd[BATCH_MAX];
+    struct bb_frame hdr, rep;
+    int *mine = malloc(cfg.n_cells * sizeof(int));
+    int n_mine = owned_cells(id, cfg.n_readers, mine);
+    uint32_t *last_gen = calloc(cfg.n_cells, sizeof(uint32_t));
+    char *have_gen = calloc(cfg.n_cells, 1);   // Got the subscription snapshot
+    long received = 0, skipped = 0;
+    char filename[32];
+    sprintf(filename, "log_R%d.txt", id);
+
+    if (n_mine > BATCH_MAX) n_mine = BATCH_MAX;
+    for (int k = 0; k < n_mine; k++) req[k].cell = mine[k];
+
+    FILE *fp = fopen(filename, "w");
+    if (fp) { fprintf(fp, "--- Log R%d ---\n", id); fclose(fp); }
+
+    hdr.type = FRAME_SUBSCRIBE;
+    hdr.count = n_mine;
+    hdr.seq = 0;
+    struct iovec iov[2] = {
+        { &hdr, sizeof(hdr) },
+        { req, n_mine * sizeof(struct bb_entry) }
+    };
+    if (writev(fd_write, iov, 2) == -1) return;
+
+    while(1) {
+        if (read_full(fd_read, &rep, sizeof(rep)) == -1) break;
+        if (read_full(fd_read, upd, rep.count * sizeof(struct bb_update)) == -1) break;
+
+        fp = cfg.bench ? NULL : fopen(filename, "a");
+        for (int k = 0; k < rep.count; k++) {
+            int c = upd[k].cell;
+            stamp_delivered(id, c, upd[k].value);
+            // Generations we never saw were conflated by the server; the
+            // first update is the value at subscription time
+            if (have_gen[c] && upd[k].gen > last_gen[c] + 1) skipped += upd[k].gen - last_gen[c] - 1;
+            last_gen[c] = upd[k].gen;
+            have_gen[c] = 1;
+            received++;
+            if (fp) fprintf(fp, "New Value in Cell %d: %d (gen %u)\n", c, upd[k].value, upd[k].gen);
+            if (VERBOSE) printf("    [R%d] Cell %d gen %u: %d\n", id, c, upd[k].gen, upd[k].value);
+        }
+        if (fp) fclose(fp);
+    }
+
+    if (!cfg.bench)
+        printf("    [R%d] %ld updates received, %ld conflated by the server\n", id, received, skipped);
+    free(mine);
+    free(last_gen);
+    free(have_gen);
+}
+
+// --- SHM WRITER ---
+void run_writer_shm(int id) {
+    int cell = id % cfg.n_cells;
+    struct shm_cell *c = &board->cell[cell];
+    srand(time(NULL) + id);
+    int val;
+    uint64_t t0 = 0;
+
+    for (long n = 0; cfg.n_ops == 0 || n < cfg.n_ops; n++) {
+        val = next_value(id, n);
+
+        if (cfg.bench) {
+            t0 = now_ns();
+            stamp_write(cell, val, t0);
+        }
+
+        // Wait until the server grants us a write
+        while (atomic_load(&grants[id]) == 0)
+            futex_wait(&grants[id], 0);
+
+        seq_write(c, val);
+
+        // Consume the grant and ring the server
+        atomic_store(&grants[id], 0);
+        ring_server(cell);
+
+        if (cfg.bench) hist_add(&bench_hist[id], now_ns() - t0);
+
+        if (VERBOSE) {
+            printf("[W%d] Successfully wrote: %d\n", id, val);
+            usleep(500000);
+        }
+    }
+
+    atomic_store(&grants[id], GRANT_DONE);
+    ring_server(cell);
+}
+
+// --- SHM READER ---
+void run_reader_shm(int id) {
+    int cell = id % cfg.n_cells;
+    struct shm_cell *c = &board->cell[cell];
+    unsigned last_seq = 0;  // Initial zero state counts as already seen
+    unsigned seq;
+    int received_val;
+    char filename[32];
+    sprintf(filename, "log_R%d.txt", id);
+
+    FILE *fp = fopen(filename, "w");
+    if (fp) { fprintf(fp, "--- Log R%d ---\n", id); fclose(fp); }
+
+    while (!atomic_load(&board->closed)) {
+        // Sleep on the seqlock counter until a new version is published
+        seq = atomic_load(&c->seq);
+        if (seq == last_seq || (seq & 1)) {
+            futex_wait(&c->seq, seq);
+            continue;
+        }
+        // The server's closing step is not a new value
+        if (atomic_load(&board->closed)) break;
+
+        received_val = seq_read(c, &last_seq);
+
+        if (cfg.bench) {
+            stamp_delivered(id, cell, received_val);
+            continue;
+        }
+
+        fp = fopen(filename, "a");
+        if (fp) {
+            fprintf(fp, "New Value in Cell %d: %d\n", cell, received_val);
+            fclose(fp);
+        }
+        if (VERBOSE) printf("    [R%d] Logged new value: %d\n", id, received_val);
+    }
+}
+
+// --- SHM SERVER ---
+// A cell has at most one grant out at a time: two writers in
+// seq_write() on the same cell would break the seqlock, and every
+// write must pass its own guard check, as on the pipe path. The next
+// grant for the cell goes out once the server has seen the holder's
+// ring, round robin over the cell's writers.
+static int *grant_holder = NULL;    // Writer holding cell c's grant, -1 = none
+static int *grant_next = NULL;      // Cell c's writer to try first next time
+
+static void shm_grant(const int *cells, const char *done, int c) {
+    if (grant_holder[c] != -1 || !writer_allowed(cells, c)) return;
+    int n = c < cfg.n_writers ? (cfg.n_writers - 1 - c) / cfg.n_cells + 1 : 0;
+    for (int t = 0; t < n; t++) {
+        int k = (grant_next[c] + t) % n;
+        int i = c + k * cfg.n_cells;
+        if (done[i]) continue;
+        grant_next[c] = (k + 1) % n;
+        grant_holder[c] = i;
+        atomic_store(&grants[i], 1);
+        futex_wake(&grants[i]);
+        return;
+    }
+}
+
+// Only enforces the writer guards; data never passes through here.
+void run_server_shm(void) {
+    unsigned seq, door;
+    int words = BITMAP_WORDS(cfg.n_cells);
+    int *cells = calloc(cfg.n_cells, sizeof(int));  // Board starts zeroed
+    uint64_t *moved = malloc(words * sizeof(uint64_t));
+    char *done = calloc(cfg.n_writers, 1);
+    int writers_left = cfg.n_writers;
+    if (!cfg.bench) printf("[Server] Shared-memory Blackboard Started. %d cells\n", cfg.n_cells);
+
+    // A finished writer no longer holds its partners back
+    cell_writers = calloc(cfg.n_cells, sizeof(int));
+    for (int i = 0; i < cfg.n_writers; i++) cell_writers[i % cfg.n_cells]++;
+    grant_holder = malloc(cfg.n_cells * sizeof(int));
+    grant_next = calloc(cfg.n_cells, sizeof(int));
+    for (int c = 0; c < cfg.n_cells; c++) grant_holder[c] = -1;
+    double start = now_sec();
+
+    for (int c = 0; c < cfg.n_cells; c++) shm_grant(cells, done, c);
+
+    while (cfg.n_ops == 0 || writers_left > 0) {
+        // Read before the bitmap: a writer that rings after we drained
+        // it makes the wait below return at once
+        door = atomic_load(&board->doorbell);
+        for (int w = 0; w < words; w++) moved[w] = atomic_exchange(&changed[w], 0);
+
+        // New values and finished writers first, so every guard below
+        // sees all of them
+        for (int w = 0; w < words; w++) {
+            for (uint64_t bits = moved[w]; bits; bits &= bits - 1) {
+                int c = w * 64 + __builtin_ctzll(bits);
+                cells[c] = seq_read(&board->cell[c], &seq);
+                // The holder rang: its grant is used up (or it finished)
+                if (grant_holder[c] != -1 && atomic_load(&grants[grant_holder[c]]) != 1)
+                    grant_holder[c] = -1;
+                for (int i = c; i < cfg.n_writers; i += cfg.n_cells) {
+                    if (!done[i] && atomic_load(&grants[i]) == GRANT_DONE) {
+                        done[i] = 1;
+                        cell_writers[c]--;
+                        writers_left--;
+                    }
+                }
+            }
+        }
+
+        // The moved cells need a new grant; other cells only if their
+        // guard reads a moved cell
+        for (int w = 0; w < words; w++) {
+            for (uint64_t bits = moved[w]; bits; bits &= bits - 1) {
+                int c = w * 64 + __builtin_ctzll(bits);
+                shm_grant(cells, done, c);
+                for (int k = deps_off[c]; k < deps_off[c + 1]; k++)
+                    shm_grant(cells, done, deps_idx[k]);
+            }
+        }
+
+        // Sleep until a writer consumes its grant
+        if (cfg.n_ops == 0 || writers_left > 0) futex_wait(&board->doorbell, door);
+    }
+
+    long total = (long)cfg.n_writers * cfg.n_ops;
+    double elapsed = now_sec() - start;
+    bench_writes = total;
+    bench_offered = total;
+    bench_seconds = elapsed;
+    if (!cfg.bench)
+        printf("[Server] shm transport: %ld writes, %.3f s -> %.0f writes/s\n",
+               total, elapsed, elapsed > 0 ? total / elapsed : 0.0);
+
+    // Readers check closed whenever their cell's sequence moves; an
+    // extra even step moves it without publishing a new version
+    atomic_store(&board->closed, 1);
+    for (int c = 0; c < cfg.n_cells; c++) {
+        atomic_fetch_add(&board->cell[c].seq, 2);
+        futex_wake(&board->cell[c].seq);
+    }
+    while (wait(NULL) > 0);
+
+    free(cells);
+    free(moved);
+    free(done);
+    free(grant_holder);
+    free(grant_next);
+    free(cell_writers);
+    cell_writers = NULL;
+}
+
+// ============================================================
+// PIPE SERVER STATE
+// One entry per connected client. The server only listens to a
+// client (EPOLLIN) while that client's guard is true.
+// ============================================================
+#define CLIENT_WRITER 0
+#define CLIENT_READER 1
+
+struct client {
+    int kind;       // CLIENT_WRITER or CLIENT_READER
+    int id;         // Index within its kind (W<id> / R<id>)
+    int cell;       // Cell written or watched
+    int fd_in;      // Server reads requests here
+    int fd_out;     // Server writes replies here
+    int alive;
+    int last_sent;  // Readers only: last value delivered
+    // Batched protocol only
+    char *rx;       // Received bytes not yet consumed as frames
+    int rx_len;
+    int *seen;      // Readers: last value delivered, per cell
+    // Subscriptions ("-s") only
+    int *dirty;     // Subscribed cells with an update not pushed yet
+    int n_dirty;
+    char *is_dirty; // Per cell
+    int out_armed;  // Waiting for EPOLLOUT on fd_out
+    int queued;     // In the flush list
+    int subscribed;
+    // Acknowledgements held back until the WAL batch is durable
+    int ack_frames;
+    int n_writes;   // Int writers: writes applied, sent as the ACK
+    uint32_t ack_seq;
+    int ack_queued;
+};
+
+// Throughput accounting for "-n" runs
+static long stat_writes = 0;    // Cell updates applied
+static long stat_offered = 0;   // Batch: write entries received (applied or still parked)
+static long stat_msgs = 0;      // Request messages (ints or frames) received
+static long stat_reads = 0;     // Values sent to int readers
+static double stat_start = 0;
+static int writers_alive = 0;
+
+// ============================================================
+// ADMISSION STATE
+// writable: compiled guard result per cell.
+// ready_set: clients armed for EPOLLIN.
+// A write only re-evaluates the guards in deps[cell] and touches the
+// clients of cells whose guard flipped; the main loop re-arms just
+// the touched clients. Nothing scans all cells or all clients.
+// ============================================================
+static struct client *sv_clients = NULL;
+static int *sv_cells = NULL;
+static uint64_t *writable = NULL;
+static uint64_t *ready_set = NULL;
+static uint64_t *touched_set = NULL;
+static int *touched_list = NULL;
+static int n_touched = 0;
+static int *ccell_off = NULL, *ccell_idx = NULL;   // Clients of each cell
+
+// Batch writes whose guard is closed are parked here, in a FIFO per
+// cell, and applied in order as soon as the guard opens, one write
+// per guard evaluation. Blocking the writer instead would deadlock two
+// writers that each own cells of several pairs, since neither could
+// finish its frame. A writer has at most WINDOW frames in flight, so
+// a queue never holds more than WINDOW * BATCH_MAX writes per writer.
+struct park_fifo {
+    int *val;           // Ring of cap values, oldest at head
+    int head, len, cap;
+};
+
+static struct park_fifo *parked = NULL;
+static char *pending_listed = NULL; // Cell is in pending_list
+static int *pending_list = NULL;    // Parked cells whose guard opened
+static int n_pending = 0;
+static int n_parked = 0;
+
+static void touch(int idx) {
+    if (bit_test(touched_set, idx)) return;
+    bit_set(touched_set, idx);
+    touched_list[n_touched++] = idx;
+}
+
+// Cell c was written (or lost its last writer): refresh the guards
+// that mention it and wake up whoever they concern.
+static void cell_changed(const int *cells, int c) {
+    for (int k = deps_off[c]; k < deps_off[c + 1]; k++) {
+        int d = deps_idx[k];
+        int w = writer_allowed(cells, d);
+        if (w == bit_test(writable, d)) continue;
+        if (w) bit_set(writable, d);
+        else bit_clear(writable, d);
+        for (int j = ccell_off[d]; j < ccell_off[d + 1]; j++)
+            if (sv_clients[ccell_idx[j]].kind == CLIENT_WRITER) touch(ccell_idx[j]);
+        if (w && parked[d].len > 0 && !pending_listed[d]) {
+            pending_listed[d] = 1;
+            pending_list[n_pending++] = d;
+        }
+    }
+    // Readers of c may now have something new
+    for (int j = ccell_off[c]; j < ccell_off[c + 1]; j++)
+        if (sv_clients[ccell_idx[j]].kind == CLIENT_READER) touch(ccell_idx[j]);
+}
+
+// ============================================================
+// SUBSCRIPTIONS
+// Every write bumps the cell generation and marks the cell dirty
+// for its subscribers. Dirty cells are pushed once per loop, so a
+// reader that falls behind gets only the latest value per cell.
+// Pushes never block: a full reader pipe just waits for EPOLLOUT.
+// ============================================================
+#define EV_OUT 0x80000000u  // epoll data flag: event is for fd_out
+
+static uint32_t *cell_gen = NULL;
+static int **cell_subs = NULL;      // Subscriber client indices per cell
+static int *n_cell_subs = NULL;
+static int *flush_list = NULL;      // Subscribers with dirty cells
+static int n_flush = 0;
+static long stat_pushed = 0;
+static long stat_push_conflated = 0;
+
+static void mark_dirty(int idx, int c) {
+    struct client *cl = &sv_clients[idx];
+    if (!cl->alive) return;
+    if (cl->is_dirty[c]) {
+        stat_push_conflated++;
+        return;
+    }
+    cl->is_dirty[c] = 1;
+    cl->dirty[cl->n_dirty++] = c;
+    if (!cl->queued) {
+        cl->queued = 1;
+        flush_list[n_flush++] = idx;
+    }
+}
+
+// ============================================================
+// REPLICATION ("-f")
+// A follower process keeps a hot copy of the blackboard and serves
+// all readers; the leader only serves writers. The leader streams
+// every applied write over a socketpair in apply order, and sends
+// each loop's batch before releasing its ACKs, so an acknowledged
+// write is at least in the follower's socket buffer. The stream
+// survives the leader: the follower drains it, and when it ends
+// without REPL_BYE the follower arms the writers itself (promotion).
+// repl->slot[] (shared memory) lets it finish what the leader was in
+// the middle of: a request read but not streamed is re-applied, a
+// write streamed but not acknowledged gets its ACK.
+// ============================================================
+#define REPL_BYE -1         // record.cell: the leader shut down cleanly
+#define EV_REPL 0x7fffffffu // epoll data for the follower's stream
+
+#define ROLE_SOLO     0     // No replication, or the follower took over
+#define ROLE_LEADER   1
+#define ROLE_FOLLOWER 2
+
+struct repl_record {
+    int32_t client;     // Writer the value came from
+    int32_t cell;
+    int32_t value;
+};
+
+struct repl_slot {
+    atomic_uint consumed;   // Requests the leader read from this writer
+    atomic_uint acked;      // ACKs the leader sent to this writer
+    atomic_int value;       // Last request read
+};
+
+struct repl_shared {
+    atomic_ullong killed_ns;    // "-k": when the leader killed itself
+    struct repl_slot slot[];    // Per client
+};
+
+static int repl_role = ROLE_SOLO;
+static int repl_follower = 0;           // Started as the follower
+static int repl_fd = -1;                // Leader: send end, follower: receive end
+static struct repl_shared *repl = NULL;
+static struct repl_record *repl_buf = NULL;
+static int repl_len = 0, repl_cap = 0;  // Leader: records not sent yet
+static char repl_rx[64 * sizeof(struct repl_record)];
+static int repl_rx_len = 0;             // Follower: partial record bytes
+static long stat_replicated = 0;
+static double repl_promoted_ms = -1;
+
+// Leader: a request was taken off writer idx's pipe
+static void repl_consumed(int idx, int val) {
+    atomic_store(&repl->slot[idx].value, val);
+    atomic_fetch_add(&repl->slot[idx].consumed, 1);
+}
+
+static void repl_append(int idx, int c, int val) {
+    if (repl_len == repl_cap) {
+        repl_cap = repl_cap ? 2 * repl_cap : 1024;
+        repl_buf = realloc(repl_buf, repl_cap * sizeof(struct repl_record));
+    }
+    repl_buf[repl_len++] = (struct repl_record){ idx, c, val };
+}
 
-        // Rule: W0 can only write if cell[0] <= cell[1] (or both 0)
-        if (cell[0] <= cell[1]) {
-            FD_SET(fd_w0_in, &readfds);
-            if (fd_w0_in > max_fd) max_fd = fd_w0_in;
+// Leader: hands this loop's writes to the follower
+static void repl_flush(void) {
+    char *p = (char *)repl_buf;
+    size_t left = repl_len * sizeof(struct repl_record);
+    while (left > 0) {
+        ssize_t n = write(repl_fd, p, left);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("[Server] follower lost, replication off");
+            close(repl_fd);
+            repl_fd = -1;
+            repl_role = ROLE_SOLO;
+            break;
         }
+        p += n;
+        left -= n;
+    }
+    stat_replicated += repl_len;
+    repl_len = 0;
+}
+
+// Failover test: die abruptly between reading a write and streaming it
+static void repl_maybe_die(void) {
+    if (cfg.kill_after == 0 || stat_writes != cfg.kill_after) return;
+    printf("[Server] -k: leader dies after %ld writes\n", stat_writes);
+    fflush(stdout);
+    atomic_store(&repl->killed_ns, now_ns());
+    raise(SIGKILL);
+}
+
+// ============================================================
+// DURABILITY
+// Every applied write is appended to a write-ahead log. Writers are
+// only acknowledged once their records are on disk: with DUR_BATCH
+// the whole loop iteration shares one fdatasync (group commit), with
+// DUR_WRITE every record gets its own. A snapshot of all cells is
+// written every SNAP_INTERVAL seconds (tmp file + rename, so it is
+// always complete) and the log is truncated behind it. On startup the
+// snapshot is mmap'd and only the log tail after it is replayed.
+// Parked batch writes are not state yet and are not logged.
+// ============================================================
+#define WAL_MAGIC  0x42424c47u  // "BBLG"
+#define SNAP_MAGIC 0x42425350u  // "BBSP"
+
+struct wal_record {
+    uint64_t lsn;       // Log sequence number, 1 = first write ever
+    int32_t cell;
+    int32_t value;
+    uint32_t check;     // Detects a torn record at the tail
+    uint32_t pad;
+};
+
+struct snap_header {
+    uint32_t magic;
+    uint32_t n_cells;
+    uint64_t lsn;       // Last write included in the snapshot
+    // Followed by n_cells int32 values
+};
+
+static int wal_fd = -1;
+static uint64_t wal_lsn = 0;            // Last LSN handed out
+static struct wal_record *wal_buf = NULL;
+static int wal_len = 0, wal_cap = 0;    // Records not written yet
+static long wal_since_snap = 0;
+static double last_snap = 0;
+static int *ack_list = NULL;
+static int n_acks = 0;
+static long stat_fsyncs = 0;
+
+static uint32_t wal_check(const struct wal_record *r) {
+    return WAL_MAGIC ^ (uint32_t)r->lsn ^ (uint32_t)(r->lsn >> 32)
+         ^ ((uint32_t)r->cell * 2654435761u) ^ (uint32_t)r->value;
+}
+
+// write() may stop short (disk full, signal): keep going until all of
+// buf is out or there is a real error
+static int write_full(int fd, const void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = write(fd, (const char *)buf + done, len - done);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += w;
+    }
+    return 0;
+}
+
+// Loads the latest snapshot and replays the log tail into cells
+static void wal_recover(int *cells) {
+    uint64_t snap_lsn = 0;
+    long replayed = 0;
+
+    int fd = open(SNAP_FILE, O_RDONLY);
+    if (fd != -1) {
+        struct stat st;
+        fstat(fd, &st);
+        if (st.st_size >= (off_t)sizeof(struct snap_header)) {
+            struct snap_header *h = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (h != MAP_FAILED) {
+                if (h->magic == SNAP_MAGIC &&
+                    st.st_size >= (off_t)(sizeof(*h) + h->n_cells * sizeof(int32_t))) {
+                    int n = h->n_cells < (uint32_t)cfg.n_cells ? (int)h->n_cells : cfg.n_cells;
+                    memcpy(cells, h + 1, n * sizeof(int32_t));
+                    snap_lsn = h->lsn;
+                }
+                munmap(h, st.st_size);
+            }
+        }
+        close(fd);
+    }
+
+    wal_lsn = snap_lsn;
+    FILE *fp = fopen(WAL_FILE, "r");
+    if (fp) {
+        struct wal_record r;
+        while (fread(&r, sizeof(r), 1, fp) == 1) {
+            if (r.check != wal_check(&r)) break; // Torn tail: stop here
+            if (r.lsn <= snap_lsn) continue;    // Already in the snapshot
+            if (r.cell >= 0 && r.cell < cfg.n_cells) cells[r.cell] = r.value;
+            wal_lsn = r.lsn;
+            replayed++;
+        }
+        fclose(fp);
+    }
+
+    printf("[Server] Recovered snapshot @%llu + %ld log records\n",
+           (unsigned long long)snap_lsn, replayed);
+}
+
+// Writes all cells to a new snapshot, then starts a fresh log. The log
+// is only truncated once the rename itself is durable: until the
+// directory is synced a crash may bring back the old snapshot, which
+// still needs the old log.
+static void wal_snapshot(const int *cells) {
+    struct snap_header h = { SNAP_MAGIC, cfg.n_cells, wal_lsn };
+    int fd = open(SNAP_TMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("snapshot open");
+        return;
+    }
+    if (write_full(fd, &h, sizeof(h)) == -1 ||
+        write_full(fd, cells, cfg.n_cells * sizeof(int32_t)) == -1 || fdatasync(fd) == -1) {
+        perror("snapshot write");
+        close(fd);
+        return;
+    }
+    close(fd);
+    if (rename(SNAP_TMP_FILE, SNAP_FILE) == -1) {
+        perror("snapshot rename");
+        return;
+    }
+    int dir = open(".", O_RDONLY | O_DIRECTORY);
+    if (dir == -1 || fsync(dir) == -1) {
+        perror("snapshot directory fsync");
+        if (dir != -1) close(dir);
+        return;
+    }
+    close(dir);
+    // Records up to wal_lsn are in the snapshot now
+    if (ftruncate(wal_fd, 0) == -1) perror("wal truncate");
+    wal_since_snap = 0;
+    last_snap = now_sec();
+}
+
+static void wal_open(int *cells) {
+    wal_recover(cells);
+    wal_fd = open(WAL_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (wal_fd == -1) {
+        perror("wal open");
+        exit(1);
+    }
+    // Start from a snapshot of the recovered state and an empty log
+    wal_snapshot(cells);
+}
+
+static void wal_write_out(void) {
+    if (wal_len == 0) return;
+    if (write_full(wal_fd, wal_buf, wal_len * sizeof(struct wal_record)) == -1) perror("wal write");
+    if (fdatasync(wal_fd) == -1) perror("wal fdatasync");
+    stat_fsyncs++;
+    wal_since_snap += wal_len;
+    wal_len = 0;
+}
+
+static void wal_append(int c, int val) {
+    if (wal_len == wal_cap) {
+        wal_cap = wal_cap ? 2 * wal_cap : 1024;
+        wal_buf = realloc(wal_buf, wal_cap * sizeof(struct wal_record));
+    }
+    struct wal_record *r = &wal_buf[wal_len++];
+    r->lsn = ++wal_lsn;
+    r->cell = c;
+    r->value = val;
+    r->pad = 0;
+    r->check = wal_check(r);
+    if (cfg.durability == DUR_WRITE) wal_write_out();
+}
+
+// Holds a writer's acknowledgement until the next commit
+static void queue_ack(struct client *cl, int frames, uint32_t seq) {
+    cl->ack_frames += frames;
+    cl->ack_seq = seq;
+    if (!cl->ack_queued) {
+        cl->ack_queued = 1;
+        ack_list[n_acks++] = cl - sv_clients;
+    }
+}
+
+// Makes the writes of this iteration durable, then releases the ACKs
+static void commit(const int *cells) {
+    if (cfg.durability != DUR_NONE) {
+        wal_write_out();
+        if (wal_since_snap >= SNAP_WAL_MAX || now_sec() - last_snap >= SNAP_INTERVAL)
+            wal_snapshot(cells);
+    }
+    if (repl_role == ROLE_LEADER && repl_len > 0) repl_flush();
+    for (int i = 0; i < n_acks; i++) {
+        struct client *cl = &sv_clients[ack_list[i]];
+        cl->ack_queued = 0;
+        if (!cl->alive) continue;
+        if (cfg.proto == PROTO_BATCH) {
+            struct bb_frame ack = { FRAME_ACK, cl->ack_frames, cl->ack_seq };
+            write(cl->fd_out, &ack, sizeof(ack)); // One ACK for all of them
+        } else {
+            int val = cl->n_writes;
+            write(cl->fd_out, &val, sizeof(int)); // Send Ack
+            // Counted after the write: a crash in between means a
+            // duplicate ACK from the follower, never a lost one, and
+            // the writer discards it by its number
+            if (repl_role == ROLE_LEADER) atomic_fetch_add(&repl->slot[ack_list[i]].acked, 1);
+        }
+        cl->ack_frames = 0;
+    }
+    n_acks = 0;
+}
+
+// Every update of the blackboard goes through here
+static void apply_write(int *cells, int c, int val) {
+    cells[c] = val;
+    stat_writes++;
+    if (cfg.durability != DUR_NONE) wal_append(c, val);
+    cell_changed(cells, c);
+    if (!cell_gen) return;
+    cell_gen[c]++;
+    for (int k = 0; k < n_cell_subs[c]; k++) mark_dirty(cell_subs[c][k], c);
+}
+
+// Cells a client writes or watches: its own cell in the int protocol,
+// all owned cells in the batch protocol
+static int client_cells(const struct client *cl, int *out) {
+    if (cfg.proto != PROTO_BATCH) {
+        out[0] = cl->cell;
+        return 1;
+    }
+    return owned_cells(cl->id, cl->kind == CLIENT_WRITER ? cfg.n_writers : cfg.n_readers, out);
+}
+
+static void count_writer(const struct client *cl, int delta) {
+    int *mine = malloc(cfg.n_cells * sizeof(int));
+    int n = client_cells(cl, mine);
+    for (int k = 0; k < n; k++) {
+        cell_writers[mine[k]] += delta;
+        // Rules comparing against a cell nobody writes anymore hold now
+        if (cell_writers[mine[k]] == 0 && writable) cell_changed(sv_cells, mine[k]);
+    }
+    free(mine);
+}
+
+static int guard_allows(const struct client *cl, const int *cells) {
+    if (cl->kind == CLIENT_WRITER)
+        return repl_role != ROLE_FOLLOWER && bit_test(writable, cl->cell);
+    // Rule: a reader can only read if its cell has changed
+    return cells[cl->cell] != cl->last_sent;
+}
+
+static void set_armed(int epfd, struct client *cl, int idx, int armed) {
+    struct epoll_event ev;
+    ev.events = armed ? EPOLLIN : 0;
+    ev.data.u32 = idx;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, cl->fd_in, &ev) == -1)
+        perror("epoll_ctl MOD");
+    if (armed) bit_set(ready_set, idx);
+    else bit_clear(ready_set, idx);
+}
+
+static void drop_client(int epfd, struct client *cl) {
+    // Deregister before closing: a closed fd can no longer be named
+    epoll_ctl(epfd, EPOLL_CTL_DEL, cl->fd_in, NULL);
+    if (cl->subscribed) epoll_ctl(epfd, EPOLL_CTL_DEL, cl->fd_out, NULL);
+    close(cl->fd_in);
+    close(cl->fd_out);
+    cl->alive = 0;
+    bit_clear(ready_set, cl - sv_clients);
+    if (cl->kind == CLIENT_WRITER) {
+        writers_alive--;
+        count_writer(cl, -1);
+    }
+    if (VERBOSE) printf("[Server] %c%d disconnected.\n",
+           cl->kind == CLIENT_WRITER ? 'W' : 'R', cl->id);
+}
 
-        // Rule: W1 can only write if cell[1] <= cell[0] (or both 0)
-        if (cell[1] <= cell[0]) {
-            FD_SET(fd_w1_in, &readfds);
-            if (fd_w1_in > max_fd) max_fd = fd_w1_in;
+// Head frame of a batch client, or NULL if it is not complete yet
+static struct bb_frame *head_frame(struct client *cl, int off) {
+    if (cl->rx_len - off < (int)sizeof(struct bb_frame)) return NULL;
+    struct bb_frame *f = (struct bb_frame *)(cl->rx + off);
+    if (cl->rx_len - off < (int)(sizeof(*f) + f->count * sizeof(struct bb_entry))) return NULL;
+    return f;
+}
+
+// Reader guard for a multi-get: at least one requested cell changed
+static int read_ready(const struct client *cl, const struct bb_frame *f, const int *cells) {
+    const struct bb_entry *e = (const struct bb_entry *)(f + 1);
+    for (int k = 0; k < f->count; k++) {
+        int c = e[k].cell;
+        if (c >= 0 && c < cfg.n_cells && cells[c] != cl->seen[c]) return 1;
+    }
+    return 0;
+}
+
+static void park_write(int c, int val) {
+    struct park_fifo *q = &parked[c];
+    if (q->len == q->cap) {
+        int cap = q->cap ? 2 * q->cap : 16;
+        int *v = malloc(cap * sizeof(int));
+        for (int k = 0; k < q->len; k++) v[k] = q->val[(q->head + k) % q->cap];
+        free(q->val);
+        q->val = v;
+        q->head = 0;
+        q->cap = cap;
+    }
+    q->val[(q->head + q->len++) % q->cap] = val;
+    n_parked++;
+}
+
+// Applies parked writes whose guard opened, oldest first. The guard is
+// re-checked after every write, as the int protocol does. Returns how
+// many were applied.
+static int flush_pending(int *cells) {
+    int applied = 0;
+    while (n_pending > 0) {
+        int c = pending_list[--n_pending];
+        struct park_fifo *q = &parked[c];
+        pending_listed[c] = 0;
+        while (q->len > 0 && bit_test(writable, c)) {
+            int val = q->val[q->head];
+            q->head = (q->head + 1) % q->cap;
+            q->len--;
+            n_parked--;
+            apply_write(cells, c, val); // May queue more cells
+            applied++;
         }
+    }
+    return applied;
+}
+
+// Applies every complete frame in the client's buffer and sends one
+// coalesced reply. Write entries pass the same guard as in the int
+// protocol, one by one (closed guard: parked). A multi-get whose cells
+// have not changed stays queued and blocks the reader.
+// Returns the amount of work done (entries applied + reads answered).
+static int serve_batch(struct client *cl, int *cells) {
+    static struct bb_frame out_hdr[WINDOW];
+    static struct bb_entry out_val[WINDOW][BATCH_MAX];
+    struct iovec iov[2 * WINDOW];
+    struct bb_frame *f;
+    int off = 0, handled = 0, n_out = 0, work = 0;
+    uint32_t last_seq = 0;
 
-        // Rule: R0 can only read if cell[0] has changed
-        if (cell[0] != last_sent[0]) {
-            FD_SET(fd_r0_in, &readfds);
-            if (fd_r0_in > max_fd) max_fd = fd_r0_in;
+    while ((f = head_frame(cl, off)) != NULL && n_out < WINDOW) {
+        struct bb_entry *e = (struct bb_entry *)(f + 1);
+
+        if (f->type == FRAME_WRITE) {
+            for (int k = 0; k < f->count; k++) {
+                int c = e[k].cell;
+                if (c < 0 || c >= cfg.n_cells) continue;
+                stat_offered++;
+                // Behind earlier parked writes even if the guard is
+                // open again: they go first
+                if (!bit_test(writable, c) || parked[c].len > 0) {
+                    park_write(c, e[k].value);
+                    continue;
+                }
+                apply_write(cells, c, e[k].value);
+                work++;
+            }
+        } else {
+            if (!read_ready(cl, f, cells)) break;
+            int n = 0;
+            for (int k = 0; k < f->count && n < BATCH_MAX; k++) {
+                int c = e[k].cell;
+                if (c < 0 || c >= cfg.n_cells) continue;
+                out_val[n_out][n].cell = c;
+                out_val[n_out][n].value = cells[c];
+                cl->seen[c] = cells[c]; // Mark as sent
+                n++;
+            }
+            out_hdr[n_out].type = FRAME_VALUES;
+            out_hdr[n_out].count = n;
+            out_hdr[n_out].seq = f->seq;
+            iov[2 * n_out].iov_base = &out_hdr[n_out];
+            iov[2 * n_out].iov_len = sizeof(struct bb_frame);
+            iov[2 * n_out + 1].iov_base = out_val[n_out];
+            iov[2 * n_out + 1].iov_len = n * sizeof(struct bb_entry);
+            n_out++;
+            work++;
         }
+        last_seq = f->seq;
+        off += sizeof(*f) + f->count * sizeof(struct bb_entry);
+        handled++;
+        stat_msgs++;
+    }
+
+    if (off > 0) {
+        memmove(cl->rx, cl->rx + off, cl->rx_len - off);
+        cl->rx_len -= off;
+    }
 
-        // Rule: R1 can only read if cell[1] has changed
-        if (cell[1] != last_sent[1]) {
-            FD_SET(fd_r1_in, &readfds);
-            if (fd_r1_in > max_fd) max_fd = fd_r1_in;
+    if (cl->kind == CLIENT_WRITER && handled > 0) {
+        queue_ack(cl, handled, last_seq);
+        if (VERBOSE) printf("[Server] W%d: %d frames applied.\n", cl->id, handled);
+    } else if (n_out > 0) {
+        writev(cl->fd_out, iov, 2 * n_out);
+    }
+    return work;
+}
+
+// Pulls everything the client has queued (fd_in is non-blocking).
+// Returns 0 when the client hung up.
+static int fill_batch(struct client *cl) {
+    while (cl->rx_len < (int)RX_BUF_SIZE) {
+        ssize_t r = read(cl->fd_in, cl->rx + cl->rx_len, RX_BUF_SIZE - cl->rx_len);
+        if (r > 0) { cl->rx_len += r; continue; }
+        if (r == 0) return 0;
+        if (errno == EAGAIN) break;
+        if (errno != EINTR) return 0;
+    }
+    return 1;
+}
+
+static int push_updates(int epfd, int idx, const int *cells);
+
+// Handles SUBSCRIBE frames. The current value of every newly
+// subscribed cell is pushed right away, so its generation is the
+// reader's baseline: writes before the subscription are not counted
+// as conflated.
+static void serve_subscribe(int epfd, int idx, const int *cells) {
+    struct client *cl = &sv_clients[idx];
+    struct bb_frame *f;
+    int off = 0;
+
+    while ((f = head_frame(cl, off)) != NULL) {
+        struct bb_entry *e = (struct bb_entry *)(f + 1);
+        for (int k = 0; f->type == FRAME_SUBSCRIBE && k < f->count; k++) {
+            int c = e[k].cell;
+            if (c < 0 || c >= cfg.n_cells) continue;
+            cell_subs[c] = realloc(cell_subs[c], (n_cell_subs[c] + 1) * sizeof(int));
+            cell_subs[c][n_cell_subs[c]++] = idx;
+            mark_dirty(idx, c);
         }
+        off += sizeof(*f) + f->count * sizeof(struct bb_entry);
+        stat_msgs++;
+    }
+    if (off > 0) {
+        memmove(cl->rx, cl->rx + off, cl->rx_len - off);
+        cl->rx_len -= off;
+    }
+    if (cl->n_dirty > 0 && !cl->out_armed) push_updates(epfd, idx, cells);
+}
 
+static void set_out_armed(int epfd, struct client *cl, int idx, int armed) {
+    struct epoll_event ev = { .events = armed ? EPOLLOUT : 0, .data.u32 = idx | EV_OUT };
+    epoll_ctl(epfd, cl->subscribed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, cl->fd_out, &ev);
+    cl->subscribed = 1;
+    cl->out_armed = armed;
+}
+
+// Pushes a subscriber's dirty cells with non-blocking writes. Frames
+// are below PIPE_BUF, so each one goes in whole or not at all.
+// Returns 0 if the pipe filled up (the rest waits for EPOLLOUT).
+static int push_updates(int epfd, int idx, const int *cells) {
+    static struct bb_update upd[BATCH_MAX];
+    struct client *cl = &sv_clients[idx];
+
+    while (cl->n_dirty > 0) {
+        int n = cl->n_dirty < BATCH_MAX ? cl->n_dirty : BATCH_MAX;
+        int first = cl->n_dirty - n;
+        for (int k = 0; k < n; k++) {
+            int c = cl->dirty[first + k];
+            upd[k].cell = c;
+            upd[k].gen = cell_gen[c];
+            upd[k].value = cells[c];
+        }
+        struct bb_frame hdr = { FRAME_UPDATE, n, 0 };
+        struct iovec iov[2] = {
+            { &hdr, sizeof(hdr) },
+            { upd, n * sizeof(struct bb_update) }
+        };
+        if (writev(cl->fd_out, iov, 2) == -1) {
+            if (errno == EAGAIN) {
+                if (!cl->out_armed) set_out_armed(epfd, cl, idx, 1);
+                return 0;
+            }
+            drop_client(epfd, cl);
+            return 1;
+        }
+        for (int k = 0; k < n; k++) cl->is_dirty[cl->dirty[first + k]] = 0;
+        cl->n_dirty = first;
+        stat_pushed += n;
+    }
+    if (cl->out_armed) set_out_armed(epfd, cl, idx, 0);
+    return 1;
+}
+
+static void flush_subscribers(int epfd, const int *cells) {
+    for (int i = 0; i < n_flush; i++) {
+        int idx = flush_list[i];
+        sv_clients[idx].queued = 0;
+        // Blocked readers are retried on EPOLLOUT, not here
+        if (sv_clients[idx].alive && !sv_clients[idx].out_armed) push_updates(epfd, idx, cells);
+    }
+    n_flush = 0;
+}
+
+// Clients of each cell (CSR), for waking only the ones a write concerns.
+// Subscribers are left out: they never wait on a guard.
+static void build_cell_index(struct client *clients, int n_clients) {
+    int *mine = malloc(cfg.n_cells * sizeof(int));
+    ccell_off = calloc(cfg.n_cells + 1, sizeof(int));
+    for (int pass = 0; pass < 2; pass++) {
+        int *fill = pass ? malloc(cfg.n_cells * sizeof(int)) : NULL;
+        if (pass) {
+            for (int c = 0; c < cfg.n_cells; c++) ccell_off[c + 1] += ccell_off[c];
+            memcpy(fill, ccell_off, cfg.n_cells * sizeof(int));
+            ccell_idx = malloc((ccell_off[cfg.n_cells] + 1) * sizeof(int));
+        }
+        for (int i = 0; i < n_clients; i++) {
+            if (cfg.subscribe && clients[i].kind == CLIENT_READER) continue;
+            int m = client_cells(&clients[i], mine);
+            for (int k = 0; k < m; k++) {
+                if (pass) ccell_idx[fill[mine[k]]++] = i;
+                else ccell_off[mine[k] + 1]++;
+            }
+        }
+        free(fill);
+    }
+    free(mine);
+}
+
+// --- REPLICATION: START ---
+// Forks the leader; the calling process becomes the follower. The
+// leader gives up the readers, the follower keeps every client so it
+// can take over the writers.
+static void repl_start(struct client *clients, int n_clients) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        perror("socketpair");
+        exit(1);
+    }
+    size_t size = sizeof(struct repl_shared) + n_clients * sizeof(struct repl_slot);
+    repl = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (repl == MAP_FAILED) {
+        perror("replication mmap");
+        exit(1);
+    }
+
+    if (fork() == 0) {
+        close(sv[0]);
+        repl_fd = sv[1];
+        repl_role = ROLE_LEADER;
+        for (int i = 0; i < n_clients; i++) {
+            if (clients[i].kind != CLIENT_READER) continue;
+            close(clients[i].fd_in);
+            close(clients[i].fd_out);
+            clients[i].alive = 0;
+        }
+        return;
+    }
+
+    close(sv[1]);
+    repl_fd = sv[0];
+    repl_role = ROLE_FOLLOWER;
+    repl_follower = 1;
+    if (!cfg.bench) printf("[Follower] Hot standby started, serving %d readers\n", cfg.n_readers);
+}
+
+// --- REPLICATION: PROMOTION ---
+// The stream ended without REPL_BYE: the leader is gone. Everything it
+// streamed has been applied already; finish its in-flight requests
+// and start serving the writers.
+static void repl_promote(int *cells, int n_clients) {
+    int recovered = 0, resent = 0;
+    for (int i = 0; i < n_clients; i++) {
+        struct client *cl = &sv_clients[i];
+        if (cl->kind != CLIENT_WRITER || !cl->alive) continue;
+        struct repl_slot *s = &repl->slot[i];
+        if (atomic_load(&s->consumed) > (unsigned)cl->n_writes) {
+            apply_write(cells, cl->cell, atomic_load(&s->value));
+            cl->n_writes++;
+            recovered++;
+        }
+        // An int writer has one request outstanding, so one ACK at most
+        if (atomic_load(&s->acked) < (unsigned)cl->n_writes) {
+            queue_ack(cl, 1, 0);
+            resent++;
+        }
+        touch(i);
+    }
+    repl_role = ROLE_SOLO;
+
+    uint64_t killed = atomic_load(&repl->killed_ns);
+    repl_promoted_ms = killed ? (now_ns() - killed) / 1e6 : 0;
+    printf("[Follower] Leader lost: promoted");
+    if (killed) printf(" %.3f ms after it died", repl_promoted_ms);
+    printf(" (%d in-flight writes recovered, %d ACKs resent)\n", recovered, resent);
+}
+
+// --- REPLICATION: RECEIVE ---
+static void repl_receive(int epfd, int *cells, int n_clients) {
+    ssize_t n = read(repl_fd, repl_rx + repl_rx_len, sizeof(repl_rx) - repl_rx_len);
+    if (n == -1 && errno == EINTR) return;
+    if (n <= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, repl_fd, NULL);
+        close(repl_fd);
+        repl_fd = -1;
+        if (repl_role == ROLE_FOLLOWER) repl_promote(cells, n_clients);
+        return;
+    }
+    repl_rx_len += n;
+
+    int used = 0;
+    while (repl_rx_len - used >= (int)sizeof(struct repl_record)) {
+        struct repl_record r;
+        memcpy(&r, repl_rx + used, sizeof(r));
+        used += sizeof(r);
+        if (r.cell == REPL_BYE) {
+            repl_role = ROLE_SOLO; // Clean shutdown, nothing to take over
+            continue;
+        }
+        if (r.cell < 0 || r.cell >= cfg.n_cells || r.client < 0 || r.client >= n_clients) continue;
+        apply_write(cells, r.cell, r.value);
+        sv_clients[r.client].n_writes++;
+        stat_replicated++;
+    }
+    memmove(repl_rx, repl_rx + used, repl_rx_len - used);
+    repl_rx_len -= used;
+}
+
+// --- SERVER PROCESS (The Blackboard) ---
+void run_server(struct client *clients, int n_clients) {
+    int *cells = calloc(cfg.n_cells, sizeof(int));  // The Blackboard Memory
+    struct epoll_event events[MAX_EVENTS];
+    int val, temp;
+
+    int epfd = epoll_create1(0);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        exit(1);
+    }
+
+    // Register every client once, disarmed; guards decide what to arm
+    for (int i = 0; i < n_clients; i++) {
+        if (!clients[i].alive) continue; // Readers of a replicated leader
+        struct epoll_event ev = { .events = 0, .data.u32 = i };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd_in, &ev) == -1) {
+            perror("epoll_ctl ADD");
+            exit(1);
+        }
+    }
+
+    if (repl_role == ROLE_FOLLOWER) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EV_REPL };
+        epoll_ctl(epfd, EPOLL_CTL_ADD, repl_fd, &ev);
+    } else if (!cfg.bench) printf("[Server] Blackboard Started. %d writers, %d readers, %d cells (%s protocol)\n",
+           cfg.n_writers, cfg.n_readers, cfg.n_cells,
+           cfg.proto == PROTO_BATCH ? "batch" : "int");
+
+    writers_alive = cfg.n_writers;
+    sv_clients = clients;
+    if (cfg.subscribe) {
+        cell_gen = calloc(cfg.n_cells, sizeof(uint32_t));
+        cell_subs = calloc(cfg.n_cells, sizeof(int *));
+        n_cell_subs = calloc(cfg.n_cells, sizeof(int));
+        flush_list = calloc(n_clients, sizeof(int));
+    }
+    sv_cells = cells;
+    ack_list = calloc(n_clients, sizeof(int));
+    if (cfg.durability != DUR_NONE) wal_open(cells);
+    cell_writers = calloc(cfg.n_cells, sizeof(int));
+    parked = calloc(cfg.n_cells, sizeof(struct park_fifo));
+    pending_listed = calloc(cfg.n_cells, 1);
+    pending_list = calloc(cfg.n_cells, sizeof(int));
+    writable = calloc(BITMAP_WORDS(cfg.n_cells), sizeof(uint64_t));
+    ready_set = calloc(BITMAP_WORDS(n_clients), sizeof(uint64_t));
+    touched_set = calloc(BITMAP_WORDS(n_clients), sizeof(uint64_t));
+    touched_list = calloc(n_clients, sizeof(int));
+
+    build_cell_index(clients, n_clients);
+
+    for (int i = 0; i < n_clients; i++)
+        if (clients[i].kind == CLIENT_WRITER) count_writer(&clients[i], +1);
+    for (int c = 0; c < cfg.n_cells; c++)
+        if (writer_allowed(cells, c)) bit_set(writable, c);
+    for (int i = 0; i < n_clients; i++) touch(i);
+    stat_start = now_sec();
+
+    while(1) {
         // ============================================================
-        // SELECT (Non-Determinism)
+        // THE LOGIC GUARDS
+        // Only touched clients are looked at: the ones whose guard a
+        // write may have flipped, and the ones just served.
+        // epoll_ctl is only issued when a guard actually flips.
+        // Batch clients are blocked by their head frame instead: frames
+        // that became admissible are served here, the rest disarm.
         // ============================================================
-        // This waits until an "Allowed" client sends a message
-        select(max_fd + 1, &readfds, NULL, NULL, NULL);
+        while (n_touched > 0 || n_pending > 0) {
+            if (n_pending > 0) {
+                flush_pending(cells);
+                continue;
+            }
+            int i = touched_list[--n_touched];
+            bit_clear(touched_set, i);
+            struct client *cl = &clients[i];
+            if (!cl->alive) continue;
+            int allow;
+            if (cfg.subscribe && cl->kind == CLIENT_READER) {
+                allow = 1; // Only ever sends SUBSCRIBE frames
+            } else if (cfg.proto == PROTO_BATCH) {
+                if (head_frame(cl, 0)) serve_batch(cl, cells);
+                allow = head_frame(cl, 0) == NULL;
+            } else {
+                allow = guard_allows(cl, cells);
+            }
+            if (allow != bit_test(ready_set, i)) set_armed(epfd, cl, i, allow);
+        }
+
+        commit(cells);
+
+        if (n_flush > 0) flush_subscribers(epfd, cells);
+
+        // A follower stays until the leader's stream has ended
+        if (cfg.n_ops > 0 && writers_alive == 0 && n_parked == 0 && repl_role != ROLE_FOLLOWER) break;
+
+        // ============================================================
+        // EPOLL (Non-Determinism)
+        // ============================================================
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
 
         // ============================================================
         // HANDLE REQUESTS (Atomicity)
         // ============================================================
+        for (int e = 0; e < n; e++) {
+            if (events[e].data.u32 == EV_REPL) {
+                repl_receive(epfd, cells, n_clients);
+                continue;
+            }
+            uint32_t idx = events[e].data.u32 & ~EV_OUT;
+            struct client *cl = &clients[idx];
+            if (!cl->alive) continue;
+
+            if (events[e].data.u32 & EV_OUT) {
+                if (events[e].events & (EPOLLERR | EPOLLHUP)) drop_client(epfd, cl);
+                // A slow subscriber drained its pipe: send what piled up
+                else push_updates(epfd, idx, cells);
+                continue;
+            }
+
+            if (!(events[e].events & EPOLLIN)) {
+                // HUP/ERR on a disarmed client: it is gone
+                drop_client(epfd, cl);
+                continue;
+            }
+
+            // Whatever happens below, this client's guard needs a look
+            touch(idx);
+
+            if (cfg.subscribe && cl->kind == CLIENT_READER) {
+                int open = fill_batch(cl);
+                serve_subscribe(epfd, idx, cells);
+                if (!open) drop_client(epfd, cl);
+                continue;
+            }
+
+            if (cfg.proto == PROTO_BATCH) {
+                int open = fill_batch(cl);
+                serve_batch(cl, cells);
+                if (!open) drop_client(epfd, cl);
+                continue;
+            }
 
-        // --- Handle Writer 0 ---
-        if (FD_ISSET(fd_w0_in, &readfds)) {
-            read(fd_w0_in, &val, sizeof(int));
-            cell[0] = val;
-            val = ACK;
-            write(fd_w0_out, &val, sizeof(int)); // Send Ack
-            printf("[Server] W0 wrote %d. State: [%d, %d]\n", cell[0], cell[0], cell[1]);
+            // An earlier request in this batch may have closed the guard
+            if (!guard_allows(cl, cells)) continue;
+
+            if (cl->kind == CLIENT_WRITER) {
+                if (read(cl->fd_in, &val, sizeof(int)) <= 0) {
+                    drop_client(epfd, cl);
+                    continue;
+                }
+                if (repl_role == ROLE_LEADER) repl_consumed(idx, val);
+                apply_write(cells, cl->cell, val);
+                cl->n_writes++;
+                stat_msgs++;
+                queue_ack(cl, 1, 0);
+                if (repl_role == ROLE_LEADER) {
+                    repl_append(idx, cl->cell, val);
+                    repl_maybe_die();
+                }
+                if (VERBOSE) printf("[Server] W%d wrote %d to cell %d.\n", cl->id, cells[cl->cell], cl->cell);
+            } else {
+                if (read(cl->fd_in, &temp, sizeof(int)) <= 0) { // Consume request
+                    drop_client(epfd, cl);
+                    continue;
+                }
+                write(cl->fd_out, &cells[cl->cell], sizeof(int)); // Send Data
+                cl->last_sent = cells[cl->cell]; // Mark as sent
+                stat_reads++;
+            }
         }
+    }
+
+    if (repl_role == ROLE_LEADER) {
+        repl_append(-1, REPL_BYE, 0);
+        repl_flush();
+        if (repl_fd != -1) close(repl_fd);
+        free(repl_buf);
+    }
+
+    bench_writes = stat_writes;
+    bench_offered = cfg.proto == PROTO_BATCH ? stat_offered : stat_writes;
+    bench_seconds = now_sec() - stat_start;
+
+    if (cfg.n_ops > 0 && !cfg.bench && repl_follower) {
+        printf("[Follower] %ld writes replicated, %ld reads served", stat_replicated, stat_reads);
+        if (repl_promoted_ms >= 0) printf(", %ld writes served after promotion", stat_writes - stat_replicated);
+        printf("\n");
+    } else if (cfg.n_ops > 0 && !cfg.bench) {
+        double elapsed = now_sec() - stat_start;
+        printf("[Server] %s protocol: %ld writes in %ld messages, %.3f s -> %.0f writes/s\n",
+               cfg.proto == PROTO_BATCH ? "batch" : "int",
+               stat_writes, stat_msgs, elapsed, stat_writes / elapsed);
+        if (cfg.subscribe)
+            printf("[Server] %ld updates pushed, %ld conflated for slow readers\n",
+                   stat_pushed, stat_push_conflated);
+        if (cfg.durability != DUR_NONE)
+            printf("[Server] durability %s: %ld fdatasync calls (%.1f writes each)\n",
+                   cfg.durability == DUR_BATCH ? "batch" : "write", stat_fsyncs,
+                   stat_fsyncs ? (double)stat_writes / stat_fsyncs : 0.0);
+    }
+
+    if (cfg.durability != DUR_NONE) {
+        wal_snapshot(cells); // Clean shutdown: next start replays nothing
+        close(wal_fd);
+        free(wal_buf);
+    }
+
+    // Closing our ends lets the readers see EOF and exit
+    for (int i = 0; i < n_clients; i++)
+        if (clients[i].alive) drop_client(epfd, &clients[i]);
+    close(epfd);
+    free(cells);
+    free(cell_writers);
+    for (int c = 0; c < cfg.n_cells; c++) free(parked[c].val);
+    free(parked);
+    free(pending_listed);
+    free(pending_list);
+    free(ack_list);
+    free(writable);
+    free(ready_set);
+    free(touched_set);
+    free(touched_list);
+    free(ccell_off);
+    free(ccell_idx);
+    cell_writers = NULL;
+    writable = NULL;
+    if (cfg.subscribe) {
+        for (int c = 0; c < cfg.n_cells; c++) free(cell_subs[c]);
+        free(cell_subs);
+        free(n_cell_subs);
+        free(cell_gen);
+        free(flush_list);
+        cell_gen = NULL;
+    }
+}
+
+// ============================================================
+// SHARDED SERVER ("-t threads")
+// Cells are split into contiguous blocks, one per thread. Each shard
+// serves the clients of its cells with its own epoll loop and keeps
+// its own writable/ready/touched bitmaps; the cell array is shared.
+// When a write changes a cell that a guard in another shard reads,
+// the writer's shard sets the guarded cell's bit in that shard's
+// recheck bitmap (atomic OR, no locks) and rings its eventfd.
+// Only the int protocol is supported here.
+// ============================================================
+#define EV_SHARD_WAKE 0xffffffffu   // epoll data for a shard's eventfd
+
+struct shard {
+    int id;
+    pthread_t thread;
+    int epfd;
+    int evfd;                   // Rung by other shards after posting rechecks
+    _Atomic uint64_t *recheck;  // Our cells to re-evaluate, posted by others
+    atomic_int posted;          // Some recheck bit may be set
+    uint64_t *writable;         // Guard bits (only our cells are used)
+    uint64_t *ready;            // Our clients armed for EPOLLIN
+    uint64_t *touched_set;
+    int *touched;
+    int n_touched;
+    long writes;
+};
+
+static struct shard *shards = NULL;
+static atomic_int shard_writers_left;
 
-        // --- Handle Writer 1 ---
-        if (FD_ISSET(fd_w1_in, &readfds)) {
-            read(fd_w1_in, &val, sizeof(int));
-            cell[1] = val;
-            val = ACK;
-            write(fd_w1_out, &val, sizeof(int)); // Send Ack
-            printf("[Server] W1 wrote %d. State: [%d, %d]\n", cell[1], cell[0], cell[1]);
+static int shard_of(int c) {
+    return (long)c * cfg.n_shards / cfg.n_cells;
+}
+
+static void shard_touch(struct shard *sh, int idx) {
+    if (bit_test(sh->touched_set, idx)) return;
+    bit_set(sh->touched_set, idx);
+    sh->touched[sh->n_touched++] = idx;
+}
+
+static void shard_wake(struct shard *sh) {
+    uint64_t one = 1;
+    write(sh->evfd, &one, sizeof(one));
+}
+
+// Re-evaluates the guard of one of our cells
+static void shard_recheck(struct shard *sh, int d) {
+    int w = writer_allowed(sv_cells, d);
+    if (w == bit_test(sh->writable, d)) return;
+    if (w) bit_set(sh->writable, d);
+    else bit_clear(sh->writable, d);
+    for (int j = ccell_off[d]; j < ccell_off[d + 1]; j++)
+        if (sv_clients[ccell_idx[j]].kind == CLIENT_WRITER) shard_touch(sh, ccell_idx[j]);
+}
+
+// Our cell c changed: local guards are re-checked now, remote ones
+// are posted to their shard
+static void shard_cell_changed(struct shard *sh, int c) {
+    for (int k = deps_off[c]; k < deps_off[c + 1]; k++) {
+        int d = deps_idx[k];
+        struct shard *owner = &shards[shard_of(d)];
+        if (owner == sh) {
+            shard_recheck(sh, d);
+            continue;
         }
+        uint64_t bit = 1ULL << (d & 63);
+        if (!(atomic_fetch_or(&owner->recheck[d >> 6], bit) & bit)) {
+            atomic_store(&owner->posted, 1);
+            shard_wake(owner);
+        }
+    }
+    for (int j = ccell_off[c]; j < ccell_off[c + 1]; j++)
+        if (sv_clients[ccell_idx[j]].kind == CLIENT_READER) shard_touch(sh, ccell_idx[j]);
+}
+
+static void shard_drop(struct shard *sh, struct client *cl) {
+    epoll_ctl(sh->epfd, EPOLL_CTL_DEL, cl->fd_in, NULL);
+    cl->alive = 0;
+    bit_clear(sh->ready, cl - sv_clients);
+    if (cl->kind != CLIENT_WRITER) return;
+    // Guards comparing against a cell nobody writes anymore hold now
+    if (__atomic_sub_fetch(&cell_writers[cl->cell], 1, __ATOMIC_RELAXED) == 0)
+        shard_cell_changed(sh, cl->cell);
+    if (atomic_fetch_sub(&shard_writers_left, 1) == 1)
+        for (int t = 0; t < cfg.n_shards; t++) shard_wake(&shards[t]);
+}
+
+static void *shard_main(void *arg) {
+    struct shard *sh = arg;
+    struct epoll_event events[MAX_EVENTS];
+    int *cells = sv_cells;
+    int val, temp;
 
-        // --- Handle Reader 0 ---
-        if (FD_ISSET(fd_r0_in, &readfds)) {
-            read(fd_r0_in, &temp, sizeof(int)); // Consume request
-            write(fd_r0_out, &cell[0], sizeof(int)); // Send Data
-            last_sent[0] = cell[0]; // Mark as sent
+    while(1) {
+        // Cross-shard notifications
+        if (atomic_exchange(&sh->posted, 0)) {
+            for (int w = 0; w < BITMAP_WORDS(cfg.n_cells); w++) {
+                uint64_t bits = atomic_exchange(&sh->recheck[w], 0);
+                while (bits) {
+                    shard_recheck(sh, w * 64 + __builtin_ctzll(bits));
+                    bits &= bits - 1;
+                }
+            }
+        }
+
+        // THE LOGIC GUARDS (touched clients only)
+        while (sh->n_touched > 0) {
+            int i = sh->touched[--sh->n_touched];
+            bit_clear(sh->touched_set, i);
+            struct client *cl = &sv_clients[i];
+            if (!cl->alive) continue;
+            int allow = cl->kind == CLIENT_WRITER
+                      ? bit_test(sh->writable, cl->cell)
+                      : __atomic_load_n(&cells[cl->cell], __ATOMIC_RELAXED) != cl->last_sent;
+            if (allow == bit_test(sh->ready, i)) continue;
+            struct epoll_event ev = { .events = allow ? EPOLLIN : 0, .data.u32 = i };
+            epoll_ctl(sh->epfd, EPOLL_CTL_MOD, cl->fd_in, &ev);
+            if (allow) bit_set(sh->ready, i);
+            else bit_clear(sh->ready, i);
+        }
+
+        if (cfg.n_ops > 0 && atomic_load(&shard_writers_left) == 0) break;
+
+        int n = epoll_wait(sh->epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
         }
 
-        // --- Handle Reader 1 ---
-        if (FD_ISSET(fd_r1_in, &readfds)) {
-            read(fd_r1_in, &temp, sizeof(int)); // Consume request
-            write(fd_r1_out, &cell[1], sizeof(int)); // Send Data
-            last_sent[1] = cell[1]; // Mark as sent
+        for (int e = 0; e < n; e++) {
+            uint32_t idx = events[e].data.u32;
+            if (idx == EV_SHARD_WAKE) {
+                uint64_t cnt;
+                read(sh->evfd, &cnt, sizeof(cnt));
+                continue;
+            }
+            struct client *cl = &sv_clients[idx];
+            if (!cl->alive) continue;
+            if (!(events[e].events & EPOLLIN)) {
+                shard_drop(sh, cl);
+                continue;
+            }
+            shard_touch(sh, idx);
+
+            if (cl->kind == CLIENT_WRITER) {
+                if (!bit_test(sh->writable, cl->cell)) continue;
+                if (read(cl->fd_in, &val, sizeof(int)) <= 0) {
+                    shard_drop(sh, cl);
+                    continue;
+                }
+                __atomic_store_n(&cells[cl->cell], val, __ATOMIC_RELEASE);
+                sh->writes++;
+                temp = ++cl->n_writes;
+                write(cl->fd_out, &temp, sizeof(int)); // Send Ack
+                shard_cell_changed(sh, cl->cell);
+                if (VERBOSE) printf("[Shard %d] W%d wrote %d to cell %d.\n", sh->id, cl->id, val, cl->cell);
+            } else {
+                val = __atomic_load_n(&cells[cl->cell], __ATOMIC_ACQUIRE);
+                if (val == cl->last_sent) continue;
+                if (read(cl->fd_in, &temp, sizeof(int)) <= 0) {
+                    shard_drop(sh, cl);
+                    continue;
+                }
+                write(cl->fd_out, &val, sizeof(int)); // Send Data
+                cl->last_sent = val;
+            }
         }
     }
+    return NULL;
 }
 
-int main() {
-    // 4 Pipe Pairs (Client->Server, Server->Client for each of the 4 clients)
-    // Convention: p_client_req (Client writes, Server reads)
-    //             p_client_res (Server writes, Client reads)
-    int p_w0_req[2], p_w0_res[2];
-    int p_w1_req[2], p_w1_res[2];
-    int p_r0_req[2], p_r0_res[2];
-    int p_r1_req[2], p_r1_res[2];
+void run_server_sharded(struct client *clients, int n_clients) {
+    int *cells = calloc(cfg.n_cells, sizeof(int));
+    int words = BITMAP_WORDS(cfg.n_cells);
 
-    pipe(p_w0_req); pipe(p_w0_res);
-    pipe(p_w1_req); pipe(p_w1_res);
-    pipe(p_r0_req); pipe(p_r0_res);
-    pipe(p_r1_req); pipe(p_r1_res);
+    sv_clients = clients;
+    sv_cells = cells;
+    cell_writers = calloc(cfg.n_cells, sizeof(int));
+    build_cell_index(clients, n_clients);
+    for (int i = 0; i < n_clients; i++)
+        if (clients[i].kind == CLIENT_WRITER) cell_writers[clients[i].cell]++;
+    atomic_store(&shard_writers_left, cfg.n_writers);
 
-    // Spawn W0
-    if (fork() == 0) {
-        close(p_w0_req[0]); close(p_w0_res[1]); // Close unused ends
-        run_writer(0, p_w0_req[1], p_w0_res[0]);
-        exit(0);
+    shards = calloc(cfg.n_shards, sizeof(struct shard));
+    for (int t = 0; t < cfg.n_shards; t++) {
+        struct shard *sh = &shards[t];
+        sh->id = t;
+        sh->epfd = epoll_create1(0);
+        sh->evfd = eventfd(0, EFD_NONBLOCK);
+        if (sh->epfd == -1 || sh->evfd == -1) {
+            perror("shard setup");
+            exit(1);
+        }
+        sh->recheck = calloc(words, sizeof(uint64_t));
+        sh->writable = calloc(words, sizeof(uint64_t));
+        sh->ready = calloc(BITMAP_WORDS(n_clients), sizeof(uint64_t));
+        sh->touched_set = calloc(BITMAP_WORDS(n_clients), sizeof(uint64_t));
+        sh->touched = calloc(n_clients, sizeof(int));
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EV_SHARD_WAKE };
+        epoll_ctl(sh->epfd, EPOLL_CTL_ADD, sh->evfd, &ev);
     }
-    // Spawn W1
-    if (fork() == 0) {
-        close(p_w1_req[0]); close(p_w1_res[1]);
-        run_writer(1, p_w1_req[1], p_w1_res[0]);
-        exit(0);
+    for (int c = 0; c < cfg.n_cells; c++)
+        if (writer_allowed(cells, c)) bit_set(shards[shard_of(c)].writable, c);
+
+    // Each client is served by the shard owning its cell
+    for (int i = 0; i < n_clients; i++) {
+        struct shard *sh = &shards[shard_of(clients[i].cell)];
+        struct epoll_event ev = { .events = 0, .data.u32 = i };
+        if (epoll_ctl(sh->epfd, EPOLL_CTL_ADD, clients[i].fd_in, &ev) == -1) {
+            perror("epoll_ctl ADD");
+            exit(1);
+        }
+        shard_touch(sh, i);
     }
-    // Spawn R0
-    if (fork() == 0) {
-        close(p_r0_req[0]); close(p_r0_res[1]);
-        run_reader(0, p_r0_req[1], p_r0_res[0]);
-        exit(0);
+
+    if (!cfg.bench) printf("[Server] Sharded Blackboard Started. %d writers, %d readers, %d cells, %d shards\n",
+           cfg.n_writers, cfg.n_readers, cfg.n_cells, cfg.n_shards);
+
+    double start = now_sec();
+    for (int t = 0; t < cfg.n_shards; t++)
+        pthread_create(&shards[t].thread, NULL, shard_main, &shards[t]);
+
+    long total = 0;
+    for (int t = 0; t < cfg.n_shards; t++) {
+        pthread_join(shards[t].thread, NULL);
+        total += shards[t].writes;
     }
-    // Spawn R1
-    if (fork() == 0) {
-        close(p_r1_req[0]); close(p_r1_res[1]);
-        run_reader(1, p_r1_req[1], p_r1_res[0]);
-        exit(0);
+
+    bench_writes = total;
+    bench_offered = total;
+    bench_seconds = now_sec() - start;
+
+    if (cfg.n_ops > 0 && !cfg.bench) {
+        double elapsed = now_sec() - start;
+        printf("[Server] %d shards: %ld writes, %.3f s -> %.0f writes/s\n",
+               cfg.n_shards, total, elapsed, total / elapsed);
+    }
+
+    // Closing our ends lets the readers see EOF and exit
+    for (int i = 0; i < n_clients; i++) {
+        close(clients[i].fd_in);
+        close(clients[i].fd_out);
+    }
+    for (int t = 0; t < cfg.n_shards; t++) {
+        struct shard *sh = &shards[t];
+        close(sh->epfd);
+        close(sh->evfd);
+        free(sh->recheck);
+        free(sh->writable);
+        free(sh->ready);
+        free(sh->touched_set);
+        free(sh->touched);
+    }
+    free(shards);
+    free(cells);
+    free(cell_writers);
+    free(ccell_off);
+    free(ccell_idx);
+    cell_writers = NULL;
+}
+
+// Client count is bounded by file descriptors, so use all we are allowed
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-w writers] [-r readers] [-c cells] [-p int|batch] [-s] [-g rules] [-d none|batch|write] [-t threads] [-f [-k writes]] [-n writes] [-b [-R rate]] [pipe|shm]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "w:r:c:p:n:sg:d:t:bR:fk:")) != -1) {
+        switch (opt) {
+            case 'w': cfg.n_writers = atoi(optarg); break;
+            case 'r': cfg.n_readers = atoi(optarg); break;
+            case 'c': cfg.n_cells = atoi(optarg); break;
+            case 'n': cfg.n_ops = atol(optarg); break;
+            case 's': cfg.subscribe = 1; break;
+            case 'g': cfg.rule_file = optarg; break;
+            case 't': cfg.n_shards = atoi(optarg); break;
+            case 'b': cfg.bench = 1; break;
+            case 'R': cfg.rate = atof(optarg); break;
+            case 'f': cfg.replicate = 1; break;
+            case 'k': cfg.replicate = 1; cfg.kill_after = atol(optarg); break;
+            case 'd':
+                if (strcmp(optarg, "batch") == 0) cfg.durability = DUR_BATCH;
+                else if (strcmp(optarg, "write") == 0) cfg.durability = DUR_WRITE;
+                else if (strcmp(optarg, "none") != 0) usage(argv[0]);
+                break;
+            case 'p':
+                if (strcmp(optarg, "batch") == 0) cfg.proto = PROTO_BATCH;
+                else if (strcmp(optarg, "int") != 0) usage(argv[0]);
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        if (strcmp(argv[optind], "shm") == 0) cfg.mode = MODE_SHM;
+        else if (strcmp(argv[optind], "pipe") != 0) usage(argv[0]);
+    }
+    if (cfg.n_writers < 0 || cfg.n_readers < 0 || cfg.n_cells < 1) usage(argv[0]);
+    if (cfg.n_shards < 0 || cfg.n_shards > cfg.n_cells) usage(argv[0]);
+    if (cfg.n_shards > 0 && (cfg.proto != PROTO_INT || cfg.subscribe || cfg.durability != DUR_NONE)) {
+        fprintf(stderr, "Sharded mode (-t) supports the int protocol only (no -p batch, -s, -d)\n");
+        exit(1);
+    }
+
+    if (cfg.mode == MODE_SHM && (cfg.proto != PROTO_INT || cfg.subscribe || cfg.durability != DUR_NONE ||
+                                 cfg.n_shards > 0)) {
+        fprintf(stderr, "The shm transport supports the int protocol only (no -p batch, -s, -d, -t)\n");
+        exit(1);
+    }
+
+    if (cfg.replicate && (cfg.mode != MODE_PIPE || cfg.proto != PROTO_INT || cfg.n_shards > 0 ||
+                          cfg.durability != DUR_NONE)) {
+        fprintf(stderr, "Replication (-f) supports the single-threaded int pipe server only (no -p batch, -t, -d, shm)\n");
+        exit(1);
+    }
+
+    if (cfg.bench) {
+        if (cfg.n_ops == 0) cfg.n_ops = 10000;
+        if (cfg.rate > 0 && (cfg.proto != PROTO_INT || cfg.mode != MODE_PIPE)) {
+            fprintf(stderr, "Open-loop load (-R) is only implemented for the int pipe protocol\n");
+            exit(1);
+        }
+        bench_setup();
+    }
+
+    load_rules(cfg.rule_file);
+    compile_rules();
+
+    if (cfg.mode == MODE_SHM) {
+        board = create_board();
+
+        for (int i = 0; i < cfg.n_writers; i++)
+            if (fork() == 0) { run_writer_shm(i); exit(0); }
+        for (int i = 0; i < cfg.n_readers; i++)
+            if (fork() == 0) { run_reader_shm(i); exit(0); }
+
+        run_server_shm(); // Returns once every client has exited
+        if (cfg.bench) bench_report();
+        return 0;
     }
 
-    // Server (Parent)
-    // Close client-side ends
-    close(p_w0_req[1]); close(p_w0_res[0]);
-    close(p_w1_req[1]); close(p_w1_res[0]);
-    close(p_r0_req[1]); close(p_r0_res[0]);
-    close(p_r1_req[1]); close(p_r1_res[0]);
+    raise_fd_limit();
+    signal(SIGPIPE, SIG_IGN); // A dead reader must not kill the server
 
-    // Bundle pipes for cleaner function call
-    int s_w0[] = {p_w0_req[0], p_w0_res[1]};
-    int s_w1[] = {p_w1_req[0], p_w1_res[1]};
-    int s_r0[] = {p_r0_req[0], p_r0_res[1]};
-    int s_r1[] = {p_r1_req[0], p_r1_res[1]};
+    int n_clients = cfg.n_writers + cfg.n_readers;
+    struct client *clients = calloc(n_clients, sizeof(struct client));
 
-    run_server(s_w0, s_w1, s_r0, s_r1);
+    for (int i = 0; i < n_clients; i++) {
+        struct client *cl = &clients[i];
+        cl->kind = i < cfg.n_writers ? CLIENT_WRITER : CLIENT_READER;
+        cl->id = cl->kind == CLIENT_WRITER ? i : i - cfg.n_writers;
+        cl->cell = cl->id % cfg.n_cells;
+        cl->alive = 1;
+        cl->last_sent = -1;
 
+        // 2 Pipes per client
+        // Convention: p_req (Client writes, Server reads)
+        //             p_res (Server writes, Client reads)
+        int p_req[2], p_res[2];
+        if (pipe(p_req) == -1 || pipe(p_res) == -1) {
+            perror("pipe (raise ulimit -n for more clients)");
+            exit(1);
+        }
+
+        if (fork() == 0) {
+            // Drop the server ends of the clients spawned before us
+            for (int j = 0; j < i; j++) {
+                close(clients[j].fd_in);
+                close(clients[j].fd_out);
+            }
+            close(p_req[0]); close(p_res[1]); // Close unused ends
+            if (cfg.subscribe && cl->kind == CLIENT_READER) {
+                run_reader_sub(cl->id, p_req[1], p_res[0]);
+            } else if (cfg.proto == PROTO_BATCH) {
+                if (cl->kind == CLIENT_WRITER) run_writer_batch(cl->id, p_req[1], p_res[0]);
+                else run_reader_batch(cl->id, p_req[1], p_res[0]);
+            } else {
+                if (cl->kind == CLIENT_WRITER) run_writer(cl->id, p_req[1], p_res[0]);
+                else run_reader(cl->id, p_req[1], p_res[0]);
+            }
+            exit(0);
+        }
+
+        // Server keeps its ends only
+        close(p_req[1]); close(p_res[0]);
+        cl->fd_in = p_req[0];
+        cl->fd_out = p_res[1];
+
+        if (cfg.subscribe && cl->kind == CLIENT_READER) {
+            fcntl(cl->fd_in, F_SETFL, O_NONBLOCK);
+            fcntl(cl->fd_out, F_SETFL, O_NONBLOCK); // Pushes must never block
+            cl->rx = malloc(RX_BUF_SIZE);
+            cl->dirty = malloc(cfg.n_cells * sizeof(int));
+            cl->is_dirty = calloc(cfg.n_cells, 1);
+        } else if (cfg.proto == PROTO_BATCH) {
+            fcntl(cl->fd_in, F_SETFL, O_NONBLOCK); // Drained until EAGAIN
+            cl->rx = malloc(RX_BUF_SIZE);
+            cl->seen = malloc(cfg.n_cells * sizeof(int));
+            for (int c = 0; c < cfg.n_cells; c++) cl->seen[c] = -1;
+        }
+    }
+
+    if (cfg.replicate) repl_start(clients, n_clients);
+
+    if (cfg.n_shards > 0) run_server_sharded(clients, n_clients);
+    else run_server(clients, n_clients);
+
+    if (cfg.replicate && !repl_follower) exit(0); // Leader: the follower reports
+
+    if (cfg.bench) {
+        // Histograms are complete once every client has exited
+        while (wait(NULL) > 0);
+        bench_report();
+    }
+
+    for (int i = 0; i < n_clients; i++) {
+        free(clients[i].rx);
+        free(clients[i].seen);
+        free(clients[i].dirty);
+        free(clients[i].is_dirty);
+    }
+    free(clients);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+# Write throughput of the blackboard at each durability level.
+# Usage: ./bench_durability.sh [writes per writer] [writers]
+
+N=${1:-20000}
+W=${2:-16}
+
+for proto in int batch; do
+    for dur in none batch write; do
+        rm -f bb_wal.log bb_snapshot.bin
+        echo "== protocol $proto, durability $dur"
+        ./BBserver -w $W -r 0 -c $((2 * W)) -p $proto -d $dur -n $N | grep -E "writes/s|fdatasync"
+    done
+done
+rm -f bb_wal.log bb_snapshot.bin
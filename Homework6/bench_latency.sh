@@ -0,0 +1,20 @@
+#!/bin/bash
+# Latency suite: one JSON line per run (latencies in microseconds).
+# Closed loop for every protocol and the shm transport, then open-loop int writers at
+# increasing per-writer rates to find where the tail falls apart.
+# Usage: ./bench_latency.sh [writes per writer] [writers] [readers]
+
+N=${1:-20000}
+W=${2:-4}
+R=${3:-2}
+C=$W
+
+for p in int batch; do
+    ./BBserver -b -p $p -w $W -r $R -c $C -n $N
+done
+./BBserver -b -p batch -s -w $W -r $R -c $C -n $N
+./BBserver -b -w $W -r $R -c $C -n $N shm
+
+for rate in 1000 5000 20000 50000; do
+    ./BBserver -b -R $rate -w $W -r $R -c $C -n $N
+done
@@ -0,0 +1,14 @@
+#!/bin/bash
+# Cost of hot-standby replication on the leader, and failover time.
+# Usage: ./bench_replication.sh [writes per writer] [writers] [readers]
+
+N=${1:-50000}
+W=${2:-4}
+R=${3:-4}
+
+echo "--- no replication"
+./BBserver -w $W -r $R -c $W -n $N | grep "writes/s"
+echo "--- with follower"
+./BBserver -f -w $W -r $R -c $W -n $N | grep -E "writes/s|replicated"
+echo "--- leader killed halfway"
+./BBserver -k $((N * W / 2)) -w $W -r $R -c $W -n $N | grep -E "promoted|replicated"
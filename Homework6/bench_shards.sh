@@ -0,0 +1,13 @@
+#!/bin/bash
+# Write-heavy scaling of the sharded blackboard server.
+# Usage: ./bench_shards.sh [writes per writer] [writers] [max threads]
+
+N=${1:-20000}
+W=${2:-32}
+T=${3:-$(nproc)}
+
+# One cell per writer: writer i writes cell i, and shards own
+# contiguous blocks of cells, so every shard gets W / t writers
+for ((t = 1; t <= T; t *= 2)); do
+    ./BBserver -t $t -w $W -r 0 -c $W -n $N | grep "writes/s"
+done